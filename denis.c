@@ -21,10 +21,16 @@
 #include <debug.h>
 #include <stdio.h>
 
+#include <nuttx/clock.h>
 #include <nuttx/kmalloc.h>
 #include <nuttx/fs/fs.h>
 
+#include <string.h>
+
 #include "denis.h"
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_CAPTURE
+#  include "denis_capture.h"
+#endif
 
 /****************************************************************************
  * Private
@@ -37,6 +43,22 @@ struct denis_dev_s
   FAR struct spi_dev_s *spi;           /* Pointer to the SPI instance */
   FAR struct denis_config_s *config;   /* Pointer to the configuration
                                         * of the DENIS device */
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_CAPTURE
+  struct denis_capture_s capture;      /* Bus traffic capture ring */
+#endif
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+  struct denis_latency_s latency;      /* Producer-to-wire latency, updated
+                                        * with the SPI bus locked */
+#endif
+};
+
+/* Per-open state, kept in filep->f_priv */
+
+struct denis_file_s
+{
+  FAR void *txbuf;                     /* Transmit buffer exported by
+                                        * mmap() */
+  bool tstamp;                         /* Writes carry denis_tstamp_s */
 };
 
 /****************************************************************************
@@ -49,6 +71,7 @@ static ssize_t denis_read(FAR struct file *, FAR char *buffer,
                             size_t buflen);
 static ssize_t denis_write(FAR struct file *filep, FAR const char *buffer,
                              size_t buflen);
+static int denis_ioctl(FAR struct file *filep, int cmd, unsigned long arg);
 
 /****************************************************************************
  * Private Data
@@ -66,7 +89,7 @@ static const struct file_operations g_denis_fops =
   denis_read,      /* read */
   denis_write,     /* write */
   NULL,            /* seek */
-  NULL,            /* ioctl */
+  denis_ioctl,     /* ioctl */
   NULL             /* poll */
 #ifndef CONFIG_DISABLE_PSEUDOFS_OPERATIONS
   , NULL           /* unlink */
@@ -116,6 +139,84 @@ void dump_hex(const void* data, size_t size) {
 	}
 }
 
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+/****************************************************************************
+ * Name: denis_latency_add
+ ****************************************************************************/
+
+/**
+ * @brief Добавить задержку в распределение
+ * 
+ * @param dist Указатель на распределение
+ * @param count Количество задержек в распределении до добавления
+ * @param ns Задержка, нс
+ */
+static void denis_latency_add(FAR struct denis_latency_dist_s *dist,
+                              uint32_t count, uint64_t ns)
+{
+  uint64_t us = ns / NSEC_PER_USEC;
+  int bucket = 0;
+
+  while (us > 1 && bucket < DENIS_LATENCY_BUCKETS - 1)
+    {
+      us >>= 1;
+      bucket++;
+    }
+
+  dist->hist[bucket]++;
+  dist->sum += ns;
+
+  if (count == 0 || ns < dist->min)
+    {
+      dist->min = ns;
+    }
+
+  if (ns > dist->max)
+    {
+      dist->max = ns;
+    }
+}
+
+/****************************************************************************
+ * Name: denis_latency_record
+ ****************************************************************************/
+
+/**
+ * @brief Учесть задержку записи с временем создания
+ * 
+ * Записи другой длины или без DENIS_TSTAMP_MAGIC пропускаются
+ * 
+ * @param dev Указатель на структуру объекта драйвера
+ * @param data Указатель на отправленные данные
+ * @param data_len Длина данных
+ * @param start Время начала передачи по шине, нс
+ * @param end Время окончания передачи по шине, нс
+ */
+static void denis_latency_record(FAR struct denis_dev_s *dev,
+                                 FAR const void *data, size_t data_len,
+                                 uint64_t start, uint64_t end)
+{
+  struct denis_tstamp_s rec;
+
+  if (data_len != sizeof(rec))
+    {
+      return;
+    }
+
+  memcpy(&rec, data, sizeof(rec));
+  if (rec.magic != DENIS_TSTAMP_MAGIC || rec.produced > start)
+    {
+      return;
+    }
+
+  denis_latency_add(&dev->latency.start, dev->latency.count,
+                    start - rec.produced);
+  denis_latency_add(&dev->latency.end, dev->latency.count,
+                    end - rec.produced);
+  dev->latency.count++;
+}
+#endif
+
 /****************************************************************************
  * Name: denis_write_dev
  ****************************************************************************/
@@ -126,15 +227,30 @@ void dump_hex(const void* data, size_t size) {
  * @param dev Указатель на структуру объекта драйвера
  * @param data Указатель на данные для записи
  * @param data_len Длинна данных
+ * @param tstamp true - данные могут быть записью denis_tstamp_s
  */
-static void denis_write_dev(FAR struct denis_dev_s *dev, const void * data, size_t data_len)
+static void denis_write_dev(FAR struct denis_dev_s *dev, const void * data, size_t data_len,
+                            bool tstamp)
 {
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+  uint64_t start = 0;
+#endif
+
   /* Lock the SPI bus so that only one device can access it at the same
    * time
    */
 
   SPI_LOCK(dev->spi, true);
 
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_CAPTURE
+  /* Copy the transaction to the capture ring while the bus is held, so
+   * that the records are in the same order as they go over the bus
+   */
+
+  denis_capture_record(&dev->capture, denis_timestamp(),
+                       dev->config->spi_devid, data, data_len);
+#endif
+
   /* Set CS to low which selects the DENIS */
 
 #warning CS pin functionality is not implemented for SPI
@@ -143,8 +259,26 @@ static void denis_write_dev(FAR struct denis_dev_s *dev, const void * data, size
   SPI_SELECT(dev->spi, dev->config->spi_devid, true);
 //   stm32_gpiowrite(GPIO_SPI1_NSS, false);
 
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+  /* The transfer starts on the bus once the device is selected */
+
+  if (tstamp)
+    {
+      start = denis_timestamp();
+    }
+#endif
+
   SPI_SNDBLOCK(dev->spi, data, data_len);
 
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+  if (tstamp)
+    {
+      denis_latency_record(dev, data, data_len, start, denis_timestamp());
+    }
+#else
+  UNUSED(tstamp);
+#endif
+
   /* Set CS to high which deselects the DENIS */
 
   /// @warning CS pin functionality is not implemented
@@ -165,13 +299,19 @@ static void denis_write_dev(FAR struct denis_dev_s *dev, const void * data, size
  * 
  * Здесь при необходимости осуществляется первичная настройка устройства
  * и инициализация приватных параметров драйвера.
- * Не требуется реализация в текущем случае
+ * Для каждого открытого файла создается denis_file_s
  * 
  * @param filep Указатель на дескриптор файла
  * @return 0 - в случае успеха, отрицательное значение в ином случае
  */
 static int denis_open(FAR struct file *filep)
 {
+    filep->f_priv = kmm_zalloc(sizeof(struct denis_file_s));
+    if (filep->f_priv == NULL)
+    {
+        return -ENOMEM;
+    }
+
     return OK;
 }
 
@@ -184,13 +324,18 @@ static int denis_open(FAR struct file *filep)
  * 
  * Здесь при необходимости осуществляются действия с устройством
  * по окончании работы с ним.
- * Не требуется реализация в текущем случае
+ * Освобождается буфер передачи, если он был отображен через mmap()
  * 
  * @param filep Указатель на дескриптор файла
  * @return 0 - в случае успеха, отрицательное значение в ином случае
  */
 static int denis_close(FAR struct file *filep)
 {
+    FAR struct denis_file_s *file = filep->f_priv;
+
+    kumm_free(file->txbuf);
+    kmm_free(file);
+    filep->f_priv = NULL;
     return OK;
 }
 
@@ -234,18 +379,163 @@ static ssize_t denis_write(FAR struct file *filep, FAR const char *buffer,
 {
     FAR struct inode *inode = filep->f_inode;
     FAR struct denis_dev_s *priv = inode->i_private;
+    FAR struct denis_file_s *file = filep->f_priv;
 
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TRACE
     printf("%s: %d bytes\n", __func__, buflen);
+#endif
 
     // Прямая запись в устройство через конкретный интерфейс
-    denis_write_dev(priv, buffer, buflen);
+    denis_write_dev(priv, buffer, buflen, file->tstamp);
 
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TRACE
     printf("%s:\n", __func__);
     dump_hex(buffer, buflen);
+#endif
 
     return buflen;
 }
 
+/****************************************************************************
+ * Name: denis_ioctl
+ ****************************************************************************/
+
+/**
+ * @brief Выполнить управляющую команду устройства Denis
+ * 
+ * @param filep Указатель на дескриптор файла
+ * @param cmd Команда DENISIOC_*
+ * @param arg Аргумент команды
+ * @return 0 - в случае успеха, отрицательное значение в ином случае
+ */
+static int denis_ioctl(FAR struct file *filep, int cmd, unsigned long arg)
+{
+  FAR struct inode *inode = filep->f_inode;
+  FAR struct denis_dev_s *priv = inode->i_private;
+  FAR struct denis_file_s *file = filep->f_priv;
+  int ret = OK;
+
+  switch (cmd)
+    {
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_CAPTURE
+      /* Start capturing the bus traffic. Arg: None */
+
+      case DENISIOC_CAPTURE_START:
+        denis_capture_enable(&priv->capture, true);
+        break;
+
+      /* Stop capturing the bus traffic. Arg: None */
+
+      case DENISIOC_CAPTURE_STOP:
+        denis_capture_enable(&priv->capture, false);
+        break;
+
+      /* Save the capture ring to a file. Arg: FAR const char *path */
+
+      case DENISIOC_CAPTURE_SAVE:
+        DEBUGASSERT(arg != 0);
+        ret = denis_capture_save(&priv->capture,
+                                 (FAR const char *)((uintptr_t)arg));
+        break;
+#endif
+
+      /* Map the transmit buffer of this file. Issued by mmap().
+       * Arg: FAR void **
+       */
+
+      case FIOC_MMAP:
+        {
+          FAR void **addrp = (FAR void **)((uintptr_t)arg);
+
+          DEBUGASSERT(addrp != NULL);
+
+          /* Буфер выделяется из пользовательской кучи при первом
+           * отображении и принадлежит открытому файлу до close()
+           */
+
+          if (file->txbuf == NULL)
+            {
+              file->txbuf = kumm_malloc(DENIS_TXBUF_SIZE);
+              if (file->txbuf == NULL)
+                {
+                  ret = -ENOMEM;
+                  break;
+                }
+            }
+
+          *addrp = file->txbuf;
+        }
+        break;
+
+      /* Send a frame from the transmit buffer without copying it.
+       * Arg: FAR const struct denis_commit_s *
+       */
+
+      case DENISIOC_COMMIT:
+        {
+          FAR const struct denis_commit_s *commit =
+            (FAR const struct denis_commit_s *)((uintptr_t)arg);
+
+          DEBUGASSERT(commit != NULL);
+
+          if (file->txbuf == NULL)
+            {
+              ret = -ENXIO;
+            }
+          else if (commit->len == 0 || commit->offset > DENIS_TXBUF_SIZE ||
+                   commit->len > DENIS_TXBUF_SIZE - commit->offset)
+            {
+              ret = -EINVAL;
+            }
+          else
+            {
+              denis_write_dev(priv,
+                              (FAR uint8_t *)file->txbuf + commit->offset,
+                              commit->len, file->tstamp);
+            }
+        }
+        break;
+
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+      /* Treat writes of this file as denis_tstamp_s records.
+       * Arg: bool enable
+       */
+
+      case DENISIOC_TSTAMP:
+        file->tstamp = (arg != 0);
+        break;
+
+      /* Read the latency distribution. The bus lock serializes this
+       * with the updates made by denis_write_dev().
+       * Arg: FAR struct denis_latency_s *
+       */
+
+      case DENISIOC_LATENCY_GET:
+        DEBUGASSERT(arg != 0);
+        SPI_LOCK(priv->spi, true);
+        memcpy((FAR void *)((uintptr_t)arg), &priv->latency,
+               sizeof(priv->latency));
+        SPI_LOCK(priv->spi, false);
+        break;
+
+      /* Clear the latency distribution. Arg: None */
+
+      case DENISIOC_LATENCY_RESET:
+        SPI_LOCK(priv->spi, true);
+        memset(&priv->latency, 0, sizeof(priv->latency));
+        SPI_LOCK(priv->spi, false);
+        break;
+#endif
+
+      default:
+        snerr("ERROR: Unrecognized cmd: %d\n", cmd);
+        ret = -ENOTTY;
+        break;
+    }
+
+  return ret;
+}
+
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
@@ -281,6 +571,19 @@ int denis_register(FAR const char *devpath, FAR struct spi_dev_s *spi,
 
   priv->spi         = spi;
   priv->config      = config;
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+  memset(&priv->latency, 0, sizeof(priv->latency));
+#endif
+
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_CAPTURE
+  ret = denis_capture_init(&priv->capture,
+                           CONFIG_EXAMPLES_TEST_TASK_DENIS_CAPTURE_SIZE);
+  if (ret < 0)
+    {
+      kmm_free(priv);
+      return ret;
+    }
+#endif
 
   /* Setup SPI frequency and mode */
 
@@ -294,6 +597,9 @@ int denis_register(FAR const char *devpath, FAR struct spi_dev_s *spi,
   if (ret < 0)
     {
       snerr("ERROR: Failed to register driver: %d\n", ret);
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_CAPTURE
+      kmm_free(priv->capture.buf);
+#endif
       kmm_free(priv);
       return ret;
     }
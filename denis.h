@@ -17,9 +17,14 @@
  ****************************************************************************/
 
 #include <nuttx/config.h>
+#include <nuttx/clock.h>
+#include <nuttx/compiler.h>
 #include <nuttx/fs/ioctl.h>
 #include <nuttx/spi/spi.h>
 
+#include <stdint.h>
+#include <time.h>
+
 /****************************************************************************
  * Pre-processor Definitions
  ****************************************************************************/
@@ -27,6 +32,103 @@
 #define DENIS_SPI_FREQUENCY    (5000000)        /* 5 MHz */
 #define DENIS_SPI_MODE         (SPIDEV_MODE3)   /* Device uses SPI Mode 3: CPOL=1, CPHA=1 */
 
+/* IOCTL commands */
+
+#define DENISIOC_CAPTURE_START _SNIOC(0x00f0)   /* Arg: None */
+#define DENISIOC_CAPTURE_STOP  _SNIOC(0x00f1)   /* Arg: None */
+#define DENISIOC_CAPTURE_SAVE  _SNIOC(0x00f2)   /* Arg: FAR const char *path */
+#define DENISIOC_COMMIT        _SNIOC(0x00f3)   /* Arg: FAR const struct denis_commit_s * */
+#define DENISIOC_TSTAMP        _SNIOC(0x00f4)   /* Arg: bool enable */
+#define DENISIOC_LATENCY_GET   _SNIOC(0x00f5)   /* Arg: FAR struct denis_latency_s * */
+#define DENISIOC_LATENCY_RESET _SNIOC(0x00f6)   /* Arg: None */
+
+/* Size of the transmit buffer returned by mmap() */
+
+#define DENIS_TXBUF_SIZE       CONFIG_EXAMPLES_TEST_TASK_DENIS_TXBUF_SIZE
+
+/* Capture file format.
+ *
+ * Файл начинается с заголовка denis_capture_hdr_s, за которым подряд
+ * следуют записи: заголовок denis_capture_rec_s и rec.len байт данных
+ * транзакции. Все поля в порядке байт целевой платформы.
+ */
+
+#define DENIS_CAPTURE_MAGIC    (0x53494e44)     /* "DNIS" */
+#define DENIS_CAPTURE_VERSION  (1)
+
+/* Timestamped counter record.
+ *
+ * В режиме DENISIOC_TSTAMP каждая запись длиной
+ * sizeof(struct denis_tstamp_s) с корректным magic считается записью
+ * с временем создания. Драйвер фиксирует моменты начала и окончания
+ * передачи по шине и накапливает распределение задержек.
+ */
+
+#define DENIS_TSTAMP_MAGIC     (0x54534e44)     /* "DNST" */
+
+/* Гистограмма задержек: корзина i содержит задержки
+ * [2^i, 2^(i+1)) мкс, корзина 0 - задержки меньше 2 мкс,
+ * последняя корзина - все задержки от 2^23 мкс
+ */
+
+#define DENIS_LATENCY_BUCKETS  (24)
+
+/****************************************************************************
+ * Public Types
+ ****************************************************************************/
+
+begin_packed_struct struct denis_capture_hdr_s
+{
+  uint32_t magic;         /* DENIS_CAPTURE_MAGIC */
+  uint16_t version;       /* DENIS_CAPTURE_VERSION */
+  uint16_t reserved;
+  uint32_t nrecords;      /* Number of records in the file */
+  uint32_t dropped;       /* Records overwritten in the RAM ring */
+} end_packed_struct;
+
+begin_packed_struct struct denis_capture_rec_s
+{
+  uint64_t timestamp;     /* CLOCK_MONOTONIC time of the transfer, ns */
+  uint16_t devid;         /* SPI device id of the transfer */
+  uint16_t len;           /* Length of the data following the record */
+} end_packed_struct;
+
+begin_packed_struct struct denis_tstamp_s
+{
+  uint32_t magic;         /* DENIS_TSTAMP_MAGIC */
+  uint32_t seq;           /* Sequence number of the record */
+  uint64_t produced;      /* CLOCK_MONOTONIC time of production, ns */
+} end_packed_struct;
+
+/* Running distribution of one latency */
+
+struct denis_latency_dist_s
+{
+  uint64_t min;           /* ns */
+  uint64_t max;           /* ns */
+  uint64_t sum;           /* ns */
+  uint32_t hist[DENIS_LATENCY_BUCKETS];
+};
+
+/* Argument of DENISIOC_LATENCY_GET */
+
+struct denis_latency_s
+{
+  uint32_t count;                     /* Timestamped records sent */
+  struct denis_latency_dist_s start;  /* Production to start of transfer */
+  struct denis_latency_dist_s end;    /* Production to end of transfer */
+};
+
+/* Argument of DENISIOC_COMMIT: range of the mmap()'ed transmit buffer
+ * to send to the device
+ */
+
+struct denis_commit_s
+{
+  uint32_t offset;        /* Offset of the frame in the transmit buffer */
+  uint32_t len;           /* Length of the frame */
+};
+
 struct denis_config_s
 {
     /* Since multiple sensors can be connected to the same SPI bus we need
@@ -37,6 +139,32 @@ struct denis_config_s
     int spi_devid;
 };
 
+/****************************************************************************
+ * Inline Functions
+ ****************************************************************************/
+
+/**
+ * @brief Получить монотонное время в наносекундах
+ *
+ * Общий источник времени драйвера и приложения: метки захвата,
+ * времени создания записей и замеров. Разрешение равно USEC_PER_TICK:
+ * в сборке с SCHED_TICKLESS это разрешение таймера, иначе - системный тик
+ *
+ * @return Текущее значение CLOCK_MONOTONIC, нс
+ */
+static inline uint64_t denis_timestamp(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/****************************************************************************
+ * Public Function Prototypes
+ ****************************************************************************/
+
 int denis_register(FAR const char *devpath, FAR struct spi_dev_s *spi,
                     FAR struct denis_config_s *config);
 
@@ -0,0 +1,306 @@
+/**
+ * @file denis_capture.c
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ *
+ * @brief Захват трафика шины устройства "denis"
+ *
+ * Каждая транзакция копируется в кольцевой буфер в RAM в виде записи
+ * denis_capture_rec_s + данные. При переполнении самые старые записи
+ * вытесняются. По запросу содержимое буфера сохраняется в файл
+ * (на sim это может быть hostfs), формат которого описан в denis.h.
+ * Метки времени имеют разрешение системных часов USEC_PER_TICK
+ * (в сборке с SCHED_TICKLESS - разрешение таймера)
+ *
+ * @version 0.1
+ * @date 2022-10-05
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+
+#include <debug.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include <nuttx/kmalloc.h>
+#include <nuttx/fs/fs.h>
+
+#include "denis_capture.h"
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * Name: denis_capture_put
+ ****************************************************************************/
+
+/**
+ * @brief Скопировать данные в кольцо с учетом перехода через границу
+ *
+ * @param cap Указатель на объект захвата
+ * @param data Указатель на данные
+ * @param len Длина данных
+ */
+static void denis_capture_put(FAR struct denis_capture_s *cap,
+                              FAR const void *data, size_t len)
+{
+  size_t chunk = cap->size - cap->head;
+
+  if (chunk > len)
+    {
+      chunk = len;
+    }
+
+  memcpy(cap->buf + cap->head, data, chunk);
+  memcpy(cap->buf, (FAR const uint8_t *)data + chunk, len - chunk);
+
+  cap->head = (cap->head + len) % cap->size;
+  cap->used += len;
+}
+
+/****************************************************************************
+ * Name: denis_capture_evict
+ ****************************************************************************/
+
+/**
+ * @brief Вытеснить самую старую запись из кольца
+ *
+ * @param cap Указатель на объект захвата
+ */
+static void denis_capture_evict(FAR struct denis_capture_s *cap)
+{
+  struct denis_capture_rec_s rec;
+  size_t chunk = cap->size - cap->tail;
+  size_t total;
+
+  if (chunk > sizeof(rec))
+    {
+      chunk = sizeof(rec);
+    }
+
+  memcpy(&rec, cap->buf + cap->tail, chunk);
+  memcpy((FAR uint8_t *)&rec + chunk, cap->buf, sizeof(rec) - chunk);
+
+  total = sizeof(rec) + rec.len;
+
+  cap->tail = (cap->tail + total) % cap->size;
+  cap->used -= total;
+  cap->nrecords--;
+  cap->dropped++;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Инициализировать объект захвата и выделить кольцевой буфер
+ *
+ * @param cap Указатель на объект захвата
+ * @param size Размер кольцевого буфера в байтах
+ * @return 0 - в случае успеха, отрицательное значение в ином случае
+ */
+int denis_capture_init(FAR struct denis_capture_s *cap, size_t size)
+{
+  memset(cap, 0, sizeof(*cap));
+
+  cap->buf = kmm_malloc(size);
+  if (cap->buf == NULL)
+    {
+      snerr("ERROR: Failed to allocate capture ring\n");
+      return -ENOMEM;
+    }
+
+  cap->size = size;
+  nxsem_init(&cap->lock, 0, 1);
+
+  return OK;
+}
+
+/**
+ * @brief Запустить или остановить захват
+ *
+ * Запуск сбрасывает содержимое кольца, чтобы в файл попала
+ * только новая сессия
+ *
+ * @param cap Указатель на объект захвата
+ * @param enable true - запустить, false - остановить
+ */
+void denis_capture_enable(FAR struct denis_capture_s *cap, bool enable)
+{
+  nxsem_wait_uninterruptible(&cap->lock);
+
+  if (enable && !cap->enabled)
+    {
+      cap->head     = 0;
+      cap->tail     = 0;
+      cap->used     = 0;
+      cap->nrecords = 0;
+      cap->dropped  = 0;
+    }
+
+  cap->enabled = enable;
+
+  nxsem_post(&cap->lock);
+}
+
+/**
+ * @brief Сохранить транзакцию в кольцевой буфер
+ *
+ * Если места не хватает, вытесняются самые старые записи.
+ * Транзакция, не помещающаяся в кольцо целиком, отбрасывается
+ *
+ * @param cap Указатель на объект захвата
+ * @param timestamp Монотонное время транзакции, нс
+ * @param devid Идентификатор устройства на шине
+ * @param data Указатель на данные транзакции
+ * @param len Длина данных
+ */
+void denis_capture_record(FAR struct denis_capture_s *cap,
+                          uint64_t timestamp, uint16_t devid,
+                          FAR const void *data, size_t len)
+{
+  struct denis_capture_rec_s rec;
+  size_t total = sizeof(rec) + len;
+
+  if (!cap->enabled)
+    {
+      return;
+    }
+
+  nxsem_wait_uninterruptible(&cap->lock);
+
+  if (len > UINT16_MAX || total > cap->size)
+    {
+      cap->dropped++;
+      goto out;
+    }
+
+  while (cap->size - cap->used < total)
+    {
+      denis_capture_evict(cap);
+    }
+
+  rec.timestamp = timestamp;
+  rec.devid     = devid;
+  rec.len       = len;
+
+  denis_capture_put(cap, &rec, sizeof(rec));
+  denis_capture_put(cap, data, len);
+  cap->nrecords++;
+
+out:
+  nxsem_post(&cap->lock);
+}
+
+/**
+ * @brief Сохранить содержимое кольца в файл и очистить кольцо
+ *
+ * Под блокировкой кольцо только подменяется новым пустым буфером,
+ * файл пишется уже после ее снятия. Так транзакции на шине не ждут
+ * записи файла, и сохранять можно в том числе на устройство,
+ * подключенное к той же шине
+ *
+ * @param cap Указатель на объект захвата
+ * @param path Путь к файлу захвата
+ * @return 0 - в случае успеха, отрицательное значение в ином случае
+ */
+int denis_capture_save(FAR struct denis_capture_s *cap,
+                       FAR const char *path)
+{
+  struct denis_capture_hdr_s hdr;
+  struct file file;
+  FAR uint8_t *empty;
+  FAR uint8_t *full;
+  size_t tail;
+  size_t used;
+  size_t chunk;
+  ssize_t nbytes;
+  int ret;
+
+  empty = kmm_malloc(cap->size);
+  if (empty == NULL)
+    {
+      snerr("ERROR: Failed to allocate capture ring\n");
+      return -ENOMEM;
+    }
+
+  ret = file_open(&file, path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (ret < 0)
+    {
+      snerr("ERROR: Failed to open %s: %d\n", path, ret);
+      kmm_free(empty);
+      return ret;
+    }
+
+  /* Забираем заполненное кольцо и продолжаем захват в пустое */
+
+  nxsem_wait_uninterruptible(&cap->lock);
+
+  hdr.magic    = DENIS_CAPTURE_MAGIC;
+  hdr.version  = DENIS_CAPTURE_VERSION;
+  hdr.reserved = 0;
+  hdr.nrecords = cap->nrecords;
+  hdr.dropped  = cap->dropped;
+
+  tail = cap->tail;
+  used = cap->used;
+
+  full          = cap->buf;
+  cap->buf      = empty;
+  cap->head     = 0;
+  cap->tail     = 0;
+  cap->used     = 0;
+  cap->nrecords = 0;
+  cap->dropped  = 0;
+
+  nxsem_post(&cap->lock);
+
+  nbytes = file_write(&file, &hdr, sizeof(hdr));
+  if (nbytes != sizeof(hdr))
+    {
+      goto errout;
+    }
+
+  /* Содержимое кольца записывается не более чем двумя кусками */
+
+  chunk = cap->size - tail;
+  if (chunk > used)
+    {
+      chunk = used;
+    }
+
+  nbytes = file_write(&file, full + tail, chunk);
+  if (nbytes != chunk)
+    {
+      goto errout;
+    }
+
+  if (used > chunk)
+    {
+      nbytes = file_write(&file, full, used - chunk);
+      if (nbytes != used - chunk)
+        {
+          goto errout;
+        }
+    }
+
+  kmm_free(full);
+
+  return file_close(&file);
+
+errout:
+  kmm_free(full);
+  file_close(&file);
+
+  snerr("ERROR: Failed to write %s: %d\n", path, (int)nbytes);
+  return nbytes < 0 ? (int)nbytes : -EIO;
+}
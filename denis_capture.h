@@ -0,0 +1,56 @@
+/**
+ * @file denis_capture.h
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ * @brief Захват трафика шины устройства "denis" в кольцевой буфер RAM
+ * @version 0.1
+ * @date 2022-10-05
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#ifndef __DENIS_CAPTURE_H
+#define __DENIS_CAPTURE_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+#include <nuttx/semaphore.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "denis.h"
+
+/****************************************************************************
+ * Public Types
+ ****************************************************************************/
+
+struct denis_capture_s
+{
+  sem_t lock;                /* Protects the ring and the counters */
+  FAR uint8_t *buf;          /* Ring of denis_capture_rec_s + data */
+  size_t size;               /* Size of the ring, bytes */
+  size_t head;               /* Offset to write the next record */
+  size_t tail;               /* Offset of the oldest record */
+  size_t used;               /* Bytes occupied in the ring */
+  uint32_t nrecords;         /* Records stored in the ring */
+  uint32_t dropped;          /* Records overwritten or rejected */
+  bool enabled;              /* Capture is running */
+};
+
+/****************************************************************************
+ * Public Function Prototypes
+ ****************************************************************************/
+
+int denis_capture_init(FAR struct denis_capture_s *cap, size_t size);
+void denis_capture_enable(FAR struct denis_capture_s *cap, bool enable);
+void denis_capture_record(FAR struct denis_capture_s *cap,
+                          uint64_t timestamp, uint16_t devid,
+                          FAR const void *data, size_t len);
+int denis_capture_save(FAR struct denis_capture_s *cap,
+                       FAR const char *path);
+
+#endif /* __DENIS_CAPTURE_H */
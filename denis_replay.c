@@ -0,0 +1,180 @@
+/**
+ * @file denis_replay.c
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ *
+ * @brief Воспроизведение захваченного трафика шины через драйвер "denis"
+ *
+ * Читает файл захвата (формат описан в denis.h) и отправляет каждую
+ * запись в устройство с исходными интервалами между транзакциями,
+ * масштабированными параметром speed.
+ *
+ * Метки времени захвата и ожидание nanosleep() имеют разрешение
+ * USEC_PER_TICK, поэтому захват требует SCHED_TICKLESS: с системным
+ * тиком все транзакции внутри тика воспроизводились бы одной пачкой
+ *
+ * @version 0.1
+ * @date 2022-10-05
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "denis.h"
+#include "denis_replay.h"
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/**
+ * @brief Дождаться заданного момента времени
+ *
+ * @param deadline Момент времени CLOCK_MONOTONIC, нс
+ */
+static void replay_wait(uint64_t deadline)
+{
+  uint64_t now = denis_timestamp();
+
+  if (deadline > now)
+    {
+      struct timespec ts;
+      uint64_t delta = deadline - now;
+
+      ts.tv_sec  = delta / NSEC_PER_SEC;
+      ts.tv_nsec = delta % NSEC_PER_SEC;
+
+      nanosleep(&ts, NULL);
+    }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Воспроизвести файл захвата через устройство
+ *
+ * @param devpath Путь к устройству, например "/dev/denis0"
+ * @param path Путь к файлу захвата
+ * @param speed Скорость воспроизведения в процентах от исходной.
+ *              100 - исходные интервалы, 200 - вдвое быстрее,
+ *              0 - без пауз между записями
+ * @return 0 - в случае успеха, отрицательное значение в ином случае
+ */
+int denis_replay(FAR const char *devpath, FAR const char *path,
+                 unsigned int speed)
+{
+  struct denis_capture_hdr_s hdr;
+  struct denis_capture_rec_s rec;
+  FAR uint8_t *data = NULL;
+  size_t data_size = 0;
+  uint64_t first_ts = 0;
+  uint64_t start = 0;
+  uint32_t nrecords = 0;
+  int ret = OK;
+  int infd;
+  int fd;
+
+  infd = open(path, O_RDONLY);
+  if (infd < 0)
+    {
+      printf("%s: Failed to open %s: %d\n", __func__, path, errno);
+      return -errno;
+    }
+
+  fd = open(devpath, O_WRONLY);
+  if (fd < 0)
+    {
+      printf("%s: Failed to open %s: %d\n", __func__, devpath, errno);
+      ret = -errno;
+      goto exit_without_close;
+    }
+
+  if (read(infd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+      hdr.magic != DENIS_CAPTURE_MAGIC ||
+      hdr.version != DENIS_CAPTURE_VERSION)
+    {
+      printf("%s: %s is not a capture file\n", __func__, path);
+      ret = -EINVAL;
+      goto exit_with_close;
+    }
+
+  printf("%s: %lu records (%lu dropped during capture), speed %u%%\n",
+         __func__, (unsigned long)hdr.nrecords, (unsigned long)hdr.dropped,
+         speed);
+
+  while (read(infd, &rec, sizeof(rec)) == sizeof(rec))
+    {
+      // Буфер под данные растет до размера самой длинной записи
+
+      if (rec.len > data_size)
+        {
+          FAR uint8_t *tmp = realloc(data, rec.len);
+          if (tmp == NULL)
+            {
+              ret = -ENOMEM;
+              goto exit_with_close;
+            }
+
+          data = tmp;
+          data_size = rec.len;
+        }
+
+      if (read(infd, data, rec.len) != rec.len)
+        {
+          printf("%s: Truncated record %lu\n", __func__,
+                 (unsigned long)nrecords);
+          ret = -EINVAL;
+          goto exit_with_close;
+        }
+
+      // Время отправки отсчитывается от первой записи файла,
+      // поэтому погрешность сна не накапливается
+
+      if (nrecords == 0)
+        {
+          first_ts = rec.timestamp;
+          start = denis_timestamp();
+        }
+      else if (speed > 0)
+        {
+          replay_wait(start + (rec.timestamp - first_ts) * 100 / speed);
+        }
+
+      if (write(fd, data, rec.len) != rec.len)
+        {
+          printf("%s: ERROR: write(%u) failed: %d\n", __func__,
+                 rec.len, errno);
+          ret = -errno;
+          goto exit_with_close;
+        }
+
+      nrecords++;
+    }
+
+  printf("%s: Replayed %lu records in %llu us\n", __func__,
+         (unsigned long)nrecords,
+         nrecords ? (unsigned long long)(denis_timestamp() - start) / 1000 : 0);
+
+exit_with_close:
+  free(data);
+  close(fd);
+
+exit_without_close:
+  close(infd);
+  return ret;
+}
@@ -0,0 +1,28 @@
+/**
+ * @file denis_replay.h
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ * @brief Воспроизведение захваченного трафика шины через драйвер "denis"
+ * @version 0.1
+ * @date 2022-10-05
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#ifndef __DENIS_REPLAY_H
+#define __DENIS_REPLAY_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+
+/****************************************************************************
+ * Public Function Prototypes
+ ****************************************************************************/
+
+int denis_replay(FAR const char *devpath, FAR const char *path,
+                 unsigned int speed);
+
+#endif /* __DENIS_REPLAY_H */
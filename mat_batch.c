@@ -0,0 +1,641 @@
+/**
+ * @file mat_batch.c
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ *
+ * @brief Пакетное умножение множества маленьких матриц одинакового размера
+ *
+ * nml_mat_dot() умножает одну пару матриц за вызов. Для потока матриц
+ * размером до 5x5 накладные расходы вызова и выделения памяти больше
+ * самих вычислений, а векторные блоки процессора простаивают.
+ * Здесь однотипные задачи собираются в пакет с раскладкой SoA
+ * (см. MAT_BATCH_ELEM) и умножаются одновременно: внутренний цикл идет
+ * по задачам пакета. Ядро написано на векторных типах GCC, поэтому на
+ * host/sim оно выполняется инструкциями SSE при любом уровне
+ * оптимизации, а не только когда сработает автовекторизация (-O3).
+ *
+ * Тип элемента (double, float32, Q31, Q15) выбирается в Kconfig.
+ * FPU STM32F4 поддерживает только одинарную точность, поэтому double
+ * на целевой платформе эмулируется программно. В форматах Q31/Q15
+ * произведения накапливаются в целых числах с запасом разрядов
+ * MAT_BATCH_HEADROOM, результат сохраняется с насыщением. На Cortex-M4
+ * ядро Q15 использует инструкции DSP: слово из двух элементов Q15
+ * соседних задач обрабатывается парой SMLAWB/SMLAWT.
+ *
+ * @version 0.1
+ * @date 2022-10-05
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mat_batch.h"
+
+#if defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_Q15) && \
+    (defined(__ARM_FEATURE_SAT) || defined(__ARM_FEATURE_DSP))
+#  include <arm_acle.h>
+#endif
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define MAT_BATCH_CHUNK        CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_SIZE
+
+/* Ширина вектора ядра: регистр SSE/NEON. Без SIMD вектор состоит из
+ * одного элемента, и ядро сводится к обычному скалярному циклу
+ */
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#  define MAT_BATCH_VEC_BYTES  (16)
+#else
+#  define MAT_BATCH_VEC_BYTES  (sizeof(mat_elem_t))
+#endif
+
+#define MAT_BATCH_LANES        (MAT_BATCH_VEC_BYTES / sizeof(mat_elem_t))
+#define MAT_BATCH_NVEC         (MAT_BATCH_TILE / MAT_BATCH_LANES)
+
+/* Аккумулятор и произведение двух векторов для выбранного типа.
+ * Q31: 32x32 -> 64, Q15: 16x16 -> 32. Каждое произведение сдвигается
+ * на MAT_BATCH_HEADROOM, чтобы сумма до 2^MAT_BATCH_HEADROOM
+ * произведений не переполнила аккумулятор.
+ */
+
+#if defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_Q31)
+typedef int64_t mat_acc_t;
+#elif defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_Q15)
+typedef int32_t mat_acc_t;
+#else
+typedef mat_elem_t mat_acc_t;
+#endif
+
+/* Полосы пакета читаются векторами без требований к выравниванию */
+
+typedef mat_elem_t mat_vec_t
+  __attribute__((vector_size(MAT_BATCH_VEC_BYTES),
+                 aligned(sizeof(mat_elem_t)), may_alias));
+typedef mat_acc_t mat_vacc_t
+  __attribute__((vector_size(MAT_BATCH_LANES * sizeof(mat_acc_t))));
+
+/* Q15 с инструкциями DSP: два элемента соседних задач в одном слове */
+
+#if defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_Q15) && \
+    defined(__ARM_FEATURE_DSP)
+#  define MAT_BATCH_DSP
+typedef uint32_t mat_pair_t __attribute__((may_alias));
+#endif
+
+#ifdef MAT_BATCH_FIXED
+#  define MAT_BATCH_VMUL(a, c) \
+  ((__builtin_convertvector(a, mat_vacc_t) * \
+    __builtin_convertvector(c, mat_vacc_t)) >> MAT_BATCH_HEADROOM)
+#else
+#  define MAT_BATCH_VMUL(a, c) ((a) * (c))
+#endif
+
+/* Ключ группировки задач по размеру: m1 [rows x inner], m2 [inner x cols].
+ * Ключей немного, поэтому задачи группируются сортировкой подсчетом
+ */
+
+#define MAT_BATCH_KEY(rows, inner, cols) \
+  (((rows) * (MAT_BATCH_MAX_DIM + 1) + (inner)) * (MAT_BATCH_MAX_DIM + 1) + \
+   (cols))
+
+#define MAT_BATCH_NKEYS \
+  MAT_BATCH_KEY(MAT_BATCH_MAX_DIM + 1, 0, 0)
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/**
+ * @brief Масштаб перевода значения в элемент пакета с диапазоном qshift
+ *
+ * @param qshift Диапазон пакета
+ * @return Множитель: элемент = значение * масштаб
+ */
+static inline double mat_batch_scale(int qshift)
+{
+#ifdef MAT_BATCH_FIXED
+  return ldexp(1.0, MAT_BATCH_FRAC_BITS - qshift);
+#else
+  return 1.0;
+#endif
+}
+
+/**
+ * @brief Преобразовать значение в элемент пакета
+ *
+ * В форматах с фиксированной точкой значение округляется к ближайшему
+ * и насыщается. Масштаб вычисляется вызывающим один раз на матрицу,
+ * поэтому на каждый элемент приходится одно умножение
+ *
+ * @param v Значение
+ * @param scale Масштаб mat_batch_scale()
+ * @return Элемент пакета
+ */
+static inline mat_elem_t mat_batch_quantize(double v, double scale)
+{
+#ifdef MAT_BATCH_FIXED
+  double qmax = (double)(((int64_t)1 << MAT_BATCH_FRAC_BITS) - 1);
+  double q = v * scale;
+
+  q = q < 0 ? q - 0.5 : q + 0.5;
+
+  return q >= qmax ? qmax : q <= -qmax - 1 ? -qmax - 1 : (mat_elem_t)q;
+#else
+  return v;
+#endif
+}
+
+/**
+ * @brief Сохранить вектор аккумуляторов в полосу результата
+ *
+ * В форматах с фиксированной точкой аккумулятор приводится к формату
+ * элемента сдвигом на MAT_BATCH_FRAC_BITS с насыщением. На ядрах с
+ * инструкцией SSAT насыщение Q15 выполняется ею
+ *
+ * @param r Полоса результата
+ * @param acc Аккумуляторы MAT_BATCH_LANES задач
+ */
+static inline void mat_batch_store(FAR mat_elem_t *r,
+                                   FAR const mat_vacc_t *acc)
+{
+#ifdef MAT_BATCH_FIXED
+  unsigned int l;
+
+  for (l = 0; l < MAT_BATCH_LANES; l++)
+    {
+#  if defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_Q31)
+      int64_t x = (*acc)[l] >> MAT_BATCH_FRAC_BITS;
+
+      r[l] = x > INT32_MAX ? INT32_MAX : x < INT32_MIN ? INT32_MIN : x;
+#  elif defined(__ARM_FEATURE_SAT)
+      r[l] = __ssat((*acc)[l] >> MAT_BATCH_FRAC_BITS, 16);
+#  else
+      int32_t x = (*acc)[l] >> MAT_BATCH_FRAC_BITS;
+
+      r[l] = x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : x;
+#  endif
+    }
+#else
+  *(FAR mat_vec_t *)r = *acc;
+#endif
+}
+
+#ifdef MAT_BATCH_DSP
+/**
+ * @brief Вычислить элемент результата для куска из MAT_BATCH_TILE задач
+ *
+ * Q15 на инструкциях DSP Cortex-M4. Соседние задачи b и b + 1 лежат в
+ * одном 32-битном слове: младшая половина - задача b, старшая - b + 1.
+ * Слово первого множителя распаковывается в два 32-битных операнда
+ * a * 2^(16 - MAT_BATCH_HEADROOM), после чего SMLAWB/SMLAWT умножают их
+ * на младшую/старшую половину слова второго множителя и накапливают
+ * старшие 32 бита: (a * 2^13 * c) >> 16 = (a * c) >> 3. Запас разрядов
+ * заложен во входной операнд, поэтому произведение не сдвигается, а
+ * результат совпадает с переносимым ядром бит в бит
+ *
+ * @param r Кусок полосы результата
+ * @param a Кусок полосы первого множителя для k = 0
+ * @param astep Расстояние между полосами первого множителя по k
+ * @param c Кусок полосы второго множителя для k = 0
+ * @param cstep Расстояние между полосами второго множителя по k
+ * @param inner Общая размерность множителей
+ */
+static void mat_batch_tile(FAR mat_elem_t *r, FAR const mat_elem_t *a,
+                           size_t astep, FAR const mat_elem_t *c,
+                           size_t cstep, unsigned int inner)
+{
+  unsigned int l;
+  unsigned int k;
+
+  // Полосы начинаются с четного индекса (stride кратен MAT_BATCH_TILE),
+  // поэтому пары задач выровнены на слово
+
+  for (l = 0; l < MAT_BATCH_TILE; l += 2)
+    {
+      int32_t acc0 = 0;
+      int32_t acc1 = 0;
+
+      for (k = 0; k < inner; k++)
+        {
+          uint32_t x = *(FAR const mat_pair_t *)(a + k * astep + l);
+          uint32_t y = *(FAR const mat_pair_t *)(c + k * cstep + l);
+
+          acc0 = __smlawb((int32_t)(x << 16) >> MAT_BATCH_HEADROOM, y, acc0);
+          acc1 = __smlawt((int32_t)(x & 0xffff0000) >> MAT_BATCH_HEADROOM,
+                          y, acc1);
+        }
+
+      r[l]     = __ssat(acc0 >> MAT_BATCH_FRAC_BITS, 16);
+      r[l + 1] = __ssat(acc1 >> MAT_BATCH_FRAC_BITS, 16);
+    }
+}
+#else
+/**
+ * @brief Вычислить элемент результата для куска из MAT_BATCH_TILE задач
+ *
+ * r[b] = sum(a[k * astep + b] * c[k * cstep + b]), k = 0..inner-1.
+ * Аккумулятор каждого вектора задач живет в регистре на всем цикле по k
+ *
+ * @param r Кусок полосы результата
+ * @param a Кусок полосы первого множителя для k = 0
+ * @param astep Расстояние между полосами первого множителя по k
+ * @param c Кусок полосы второго множителя для k = 0
+ * @param cstep Расстояние между полосами второго множителя по k
+ * @param inner Общая размерность множителей
+ */
+static void mat_batch_tile(FAR mat_elem_t *r, FAR const mat_elem_t *a,
+                           size_t astep, FAR const mat_elem_t *c,
+                           size_t cstep, unsigned int inner)
+{
+  mat_vacc_t acc[MAT_BATCH_NVEC];
+  unsigned int v;
+  unsigned int k;
+
+  for (v = 0; v < MAT_BATCH_NVEC; v++)
+    {
+      acc[v] = (mat_vacc_t){ 0 };
+    }
+
+  for (k = 0; k < inner; k++)
+    {
+      FAR const mat_vec_t *va = (FAR const mat_vec_t *)(a + k * astep);
+      FAR const mat_vec_t *vc = (FAR const mat_vec_t *)(c + k * cstep);
+
+      for (v = 0; v < MAT_BATCH_NVEC; v++)
+        {
+          acc[v] += MAT_BATCH_VMUL(va[v], vc[v]);
+        }
+    }
+
+  for (v = 0; v < MAT_BATCH_NVEC; v++)
+    {
+      mat_batch_store(r + v * MAT_BATCH_LANES, &acc[v]);
+    }
+}
+#endif
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Создать пакет из count матриц размером [num_rows x num_cols]
+ *
+ * @param m Указатель на пакет
+ * @param num_rows Количество строк каждой матрицы
+ * @param num_cols Количество столбцов каждой матрицы
+ * @param count Количество матриц в пакете
+ * @return 0 - в случае успеха, отрицательное значение в ином случае
+ */
+int mat_batch_init(FAR struct mat_batch_s *m, unsigned int num_rows,
+                   unsigned int num_cols, unsigned int count)
+{
+  if (num_rows == 0 || num_cols == 0 || count == 0)
+    {
+      return -EINVAL;
+    }
+
+  m->stride = (count + MAT_BATCH_TILE - 1) / MAT_BATCH_TILE * MAT_BATCH_TILE;
+  m->data   = calloc((size_t)num_rows * num_cols * m->stride,
+                     sizeof(mat_elem_t));
+  if (m->data == NULL)
+    {
+      return -ENOMEM;
+    }
+
+  m->num_rows = num_rows;
+  m->num_cols = num_cols;
+  m->count    = count;
+  m->qshift   = MAT_BATCH_QSHIFT;
+
+  return OK;
+}
+
+/**
+ * @brief Освободить память пакета
+ *
+ * @param m Указатель на пакет
+ */
+void mat_batch_free(FAR struct mat_batch_s *m)
+{
+  free(m->data);
+  m->data = NULL;
+}
+
+/**
+ * @brief Преобразовать значение double в элемент пакета
+ *
+ * В форматах с фиксированной точкой значение округляется и насыщается
+ * до диапазона пакета +-2^qshift
+ *
+ * @param m Указатель на пакет
+ * @param v Значение
+ * @return Элемент пакета
+ */
+mat_elem_t mat_batch_from_double(FAR const struct mat_batch_s *m, double v)
+{
+  return mat_batch_quantize(v, mat_batch_scale(m->qshift));
+}
+
+/**
+ * @brief Преобразовать элемент пакета в double
+ *
+ * @param m Указатель на пакет
+ * @param v Элемент пакета
+ * @return Значение
+ */
+double mat_batch_to_double(FAR const struct mat_batch_s *m, mat_elem_t v)
+{
+  return v / mat_batch_scale(m->qshift);
+}
+
+/**
+ * @brief Заполнить пакет случайными значениями из [min, max]
+ *
+ * В отличие от nml_mat_rnd() значения генерируются сразу в формате
+ * элемента, без промежуточных вычислений в double
+ *
+ * @param m Указатель на пакет
+ * @param min Нижняя граница, в пределах +-2^qshift
+ * @param max Верхняя граница, в пределах +-2^qshift
+ */
+void mat_batch_rnd(FAR struct mat_batch_s *m, int min, int max)
+{
+  size_t n = (size_t)m->num_rows * m->num_cols * m->stride;
+  size_t x;
+
+#ifdef MAT_BATCH_FIXED
+  int64_t qmin = (int64_t)min << (MAT_BATCH_FRAC_BITS - m->qshift);
+  int64_t qmax = (int64_t)max << (MAT_BATCH_FRAC_BITS - m->qshift);
+  int64_t limit = ((int64_t)1 << MAT_BATCH_FRAC_BITS) - 1;
+  uint64_t span;
+
+  qmin = qmin < -limit - 1 ? -limit - 1 : qmin;
+  qmax = qmax > limit ? limit : qmax;
+  span = qmax - qmin + 1;
+
+  for (x = 0; x < n; x++)
+    {
+      uint64_t r = ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+
+      m->data[x] = qmin + (int64_t)(r % span);
+    }
+#else
+  mat_elem_t scale = (mat_elem_t)(max - min) / RAND_MAX;
+
+  for (x = 0; x < n; x++)
+    {
+      m->data[x] = min + rand() * scale;
+    }
+#endif
+}
+
+/**
+ * @brief Скопировать матрицу nml в задачу b пакета
+ *
+ * @param m Указатель на пакет
+ * @param b Номер задачи в пакете
+ * @param src Матрица такого же размера, как матрицы пакета
+ */
+void mat_batch_set(FAR struct mat_batch_s *m, unsigned int b,
+                   FAR const nml_mat *src)
+{
+  double scale = mat_batch_scale(m->qshift);
+  FAR mat_elem_t *lane = &MAT_BATCH_ELEM(m, 0, 0, b);
+  unsigned int i;
+  unsigned int j;
+
+  for (i = 0; i < m->num_rows; i++)
+    {
+      FAR const double *row = src->data[i];
+
+      for (j = 0; j < m->num_cols; j++)
+        {
+          *lane = mat_batch_quantize(row[j], scale);
+          lane += m->stride;
+        }
+    }
+}
+
+/**
+ * @brief Скопировать задачу b пакета в матрицу nml
+ *
+ * @param m Указатель на пакет
+ * @param b Номер задачи в пакете
+ * @param dst Матрица такого же размера, как матрицы пакета
+ */
+void mat_batch_get(FAR const struct mat_batch_s *m, unsigned int b,
+                   FAR nml_mat *dst)
+{
+  double scale = 1.0 / mat_batch_scale(m->qshift);
+  FAR const mat_elem_t *lane = &MAT_BATCH_ELEM(m, 0, 0, b);
+  unsigned int i;
+  unsigned int j;
+
+  for (i = 0; i < m->num_rows; i++)
+    {
+      FAR double *row = dst->data[i];
+
+      for (j = 0; j < m->num_cols; j++)
+        {
+          row[j] = *lane * scale;
+          lane += m->stride;
+        }
+    }
+}
+
+/**
+ * @brief Перемножить пакеты матриц: r[b] = m1[b] * m2[b] для всех b
+ *
+ * Память под результат выделяется вызывающим (mat_batch_init).
+ * Пакеты должны иметь одинаковую длину полосы stride.
+ * В форматах с фиксированной точкой диапазон результата
+ * r->qshift = m1->qshift + m2->qshift + MAT_BATCH_HEADROOM
+ *
+ * @param r Пакет результатов [m1 rows x m2 cols]
+ * @param m1 Пакет первых множителей
+ * @param m2 Пакет вторых множителей
+ * @return 0 - в случае успеха, -EINVAL при несовпадении размеров
+ */
+int mat_batch_dot(FAR struct mat_batch_s *r, FAR const struct mat_batch_s *m1,
+                  FAR const struct mat_batch_s *m2)
+{
+  unsigned int n = r->count;
+  unsigned int b0;
+  unsigned int i;
+  unsigned int j;
+
+  if (m1->num_cols != m2->num_rows || r->num_rows != m1->num_rows ||
+      r->num_cols != m2->num_cols || m1->count != n || m2->count != n ||
+      m1->stride != r->stride || m2->stride != r->stride)
+    {
+      return -EINVAL;
+    }
+
+  r->qshift = m1->qshift + m2->qshift + MAT_BATCH_HEADROOM;
+
+  for (i = 0; i < r->num_rows; i++)
+    {
+      for (j = 0; j < r->num_cols; j++)
+        {
+          for (b0 = 0; b0 < n; b0 += MAT_BATCH_TILE)
+            {
+              mat_batch_tile(&MAT_BATCH_ELEM(r, i, j, b0),
+                             &MAT_BATCH_ELEM(m1, i, 0, b0), m1->stride,
+                             &MAT_BATCH_ELEM(m2, 0, j, b0),
+                             (size_t)m2->num_cols * m2->stride,
+                             m1->num_cols);
+            }
+        }
+    }
+
+  return OK;
+}
+
+/**
+ * @brief Перемножить n пар матриц произвольных размеров
+ *
+ * Задачи группируются по размеру, каждая группа умножается пакетами
+ * по CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_SIZE задач. Результаты
+ * записываются в матрицы r[], которые вызывающий создает заранее
+ * размером [m1 rows x m2 cols] и может использовать повторно: память
+ * на каждое произведение не выделяется
+ *
+ * @param r Массив из n матриц результатов
+ * @param m1 Массив из n первых множителей
+ * @param m2 Массив из n вторых множителей
+ * @param n Количество задач
+ * @return 0 - в случае успеха, отрицательное значение в ином случае
+ */
+int mat_batch_dot_many(FAR nml_mat *const *r, FAR nml_mat *const *m1,
+                       FAR nml_mat *const *m2, size_t n)
+{
+  FAR size_t *order;
+  FAR size_t *bucket;
+  struct mat_batch_s a;
+  struct mat_batch_s c;
+  struct mat_batch_s p;
+  size_t start;
+  size_t end;
+  size_t x;
+  int ret = OK;
+
+  for (x = 0; x < n; x++)
+    {
+      if (m1[x]->num_cols != m2[x]->num_rows ||
+          m1[x]->num_rows > MAT_BATCH_MAX_DIM ||
+          m1[x]->num_cols > MAT_BATCH_MAX_DIM ||
+          m2[x]->num_cols > MAT_BATCH_MAX_DIM ||
+          r[x]->num_rows != m1[x]->num_rows ||
+          r[x]->num_cols != m2[x]->num_cols)
+        {
+          return -EINVAL;
+        }
+    }
+
+  // order[] - номера задач, упорядоченные по ключу размера,
+  // bucket[] - начало группы каждого ключа в order[]
+
+  order = malloc((n + MAT_BATCH_NKEYS + 1) * sizeof(*order));
+  if (order == NULL)
+    {
+      return -ENOMEM;
+    }
+
+  bucket = order + n;
+  memset(bucket, 0, (MAT_BATCH_NKEYS + 1) * sizeof(*bucket));
+
+  for (x = 0; x < n; x++)
+    {
+      bucket[MAT_BATCH_KEY(m1[x]->num_rows, m1[x]->num_cols,
+                           m2[x]->num_cols) + 1]++;
+    }
+
+  for (x = 0; x < MAT_BATCH_NKEYS; x++)
+    {
+      bucket[x + 1] += bucket[x];
+    }
+
+  for (x = 0; x < n; x++)
+    {
+      order[bucket[MAT_BATCH_KEY(m1[x]->num_rows, m1[x]->num_cols,
+                                 m2[x]->num_cols)]++] = x;
+    }
+
+  // Рабочие пакеты выделяются один раз под максимальный размер,
+  // для каждой группы меняются только размеры
+
+  a.data = NULL;
+  c.data = NULL;
+  p.data = NULL;
+
+  if (mat_batch_init(&a, MAT_BATCH_MAX_DIM, MAT_BATCH_MAX_DIM,
+                     MAT_BATCH_CHUNK) < 0 ||
+      mat_batch_init(&c, MAT_BATCH_MAX_DIM, MAT_BATCH_MAX_DIM,
+                     MAT_BATCH_CHUNK) < 0 ||
+      mat_batch_init(&p, MAT_BATCH_MAX_DIM, MAT_BATCH_MAX_DIM,
+                     MAT_BATCH_CHUNK) < 0)
+    {
+      ret = -ENOMEM;
+      goto out;
+    }
+
+  for (start = 0; start < n; start = end)
+    {
+      FAR const nml_mat *first = m1[order[start]];
+      unsigned int cols = m2[order[start]]->num_cols;
+      unsigned int b;
+
+      // Набираем пакет из задач одного размера, не больше MAT_BATCH_CHUNK
+
+      for (end = start + 1;
+           end < n && end - start < MAT_BATCH_CHUNK &&
+           m1[order[end]]->num_rows == first->num_rows &&
+           m1[order[end]]->num_cols == first->num_cols &&
+           m2[order[end]]->num_cols == cols;
+           end++);
+
+      a.num_rows = first->num_rows;
+      a.num_cols = first->num_cols;
+      c.num_rows = first->num_cols;
+      c.num_cols = cols;
+      p.num_rows = first->num_rows;
+      p.num_cols = cols;
+      a.count = c.count = p.count = end - start;
+
+      for (b = 0; b < a.count; b++)
+        {
+          mat_batch_set(&a, b, m1[order[start + b]]);
+          mat_batch_set(&c, b, m2[order[start + b]]);
+        }
+
+      mat_batch_dot(&p, &a, &c);
+
+      for (b = 0; b < p.count; b++)
+        {
+          mat_batch_get(&p, b, r[order[start + b]]);
+        }
+    }
+
+out:
+  mat_batch_free(&a);
+  mat_batch_free(&c);
+  mat_batch_free(&p);
+  free(order);
+
+  return ret;
+}
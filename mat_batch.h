@@ -0,0 +1,126 @@
+/**
+ * @file mat_batch.h
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ * @brief Пакетное умножение множества маленьких матриц одинакового размера
+ * @version 0.1
+ * @date 2022-10-05
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __MAT_BATCH_H
+#define __MAT_BATCH_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libs/nml/nml.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define MAT_BATCH_MAX_DIM      (5)    /* Largest supported rows/cols */
+
+/* Полоса пакета обрабатывается кусками по MAT_BATCH_TILE задач, и
+ * место в полосе выделяется с округлением до этого числа. Ядро всегда
+ * обрабатывает кусок целиком, лишние задачи в конце полосы считаются
+ * вхолостую
+ */
+
+#define MAT_BATCH_TILE         (16)
+
+/* Запас разрядов результата под сумму до 2^3 произведений (MAX_DIM <= 8) */
+
+#define MAT_BATCH_HEADROOM     (3)
+
+/* Тип элемента выбирается в Kconfig. В форматах с фиксированной точкой
+ * значение элемента равно q / 2^MAT_BATCH_FRAC_BITS * 2^qshift, где
+ * qshift - диапазон пакета (см. struct mat_batch_s). Новые пакеты
+ * создаются с диапазоном входных значений +-2^MAT_BATCH_QSHIFT, в
+ * форматах с плавающей точкой он не используется
+ */
+
+#if defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_FLOAT)
+#  define MAT_BATCH_TYPE_NAME  "float32"
+#elif defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_Q31)
+#  define MAT_BATCH_TYPE_NAME  "q31"
+#  define MAT_BATCH_FIXED
+#  define MAT_BATCH_FRAC_BITS  (31)
+#  define MAT_BATCH_QSHIFT     CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_QSHIFT
+#elif defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_Q15)
+#  define MAT_BATCH_TYPE_NAME  "q15"
+#  define MAT_BATCH_FIXED
+#  define MAT_BATCH_FRAC_BITS  (15)
+#  define MAT_BATCH_QSHIFT     CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_QSHIFT
+#else
+#  define MAT_BATCH_TYPE_NAME  "double"
+#endif
+
+#ifndef MAT_BATCH_FIXED
+#  define MAT_BATCH_QSHIFT     (0)
+#endif
+
+/* Элемент (i, j) задачи b пакета m.
+ *
+ * Пакет хранится в виде "структуры массивов" (SoA): одноименные элементы
+ * всех задач пакета лежат подряд, поэтому внутренний цикл по задачам
+ * идет по непрерывной памяти и выполняется SIMD-инструкциями.
+ */
+
+#define MAT_BATCH_ELEM(m, i, j, b) \
+  ((m)->data[((i) * (m)->num_cols + (j)) * (m)->stride + (b)])
+
+/****************************************************************************
+ * Public Types
+ ****************************************************************************/
+
+#if defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_FLOAT)
+typedef float mat_elem_t;
+#elif defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_Q31)
+typedef int32_t mat_elem_t;
+#elif defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_Q15)
+typedef int16_t mat_elem_t;
+#else
+typedef double mat_elem_t;
+#endif
+
+struct mat_batch_s
+{
+  unsigned int num_rows;     /* Rows of every matrix in the batch */
+  unsigned int num_cols;     /* Columns of every matrix in the batch */
+  unsigned int count;        /* Number of matrices in the batch */
+  unsigned int stride;       /* Lane length: capacity rounded up to
+                              * MAT_BATCH_TILE */
+  int qshift;                /* Fixed point only: values are within
+                              * +-2^qshift */
+  FAR mat_elem_t *data;      /* num_rows * num_cols lanes of stride values */
+};
+
+/****************************************************************************
+ * Public Function Prototypes
+ ****************************************************************************/
+
+int mat_batch_init(FAR struct mat_batch_s *m, unsigned int num_rows,
+                   unsigned int num_cols, unsigned int count);
+void mat_batch_free(FAR struct mat_batch_s *m);
+mat_elem_t mat_batch_from_double(FAR const struct mat_batch_s *m, double v);
+double mat_batch_to_double(FAR const struct mat_batch_s *m, mat_elem_t v);
+void mat_batch_rnd(FAR struct mat_batch_s *m, int min, int max);
+void mat_batch_set(FAR struct mat_batch_s *m, unsigned int b,
+                   FAR const nml_mat *src);
+void mat_batch_get(FAR const struct mat_batch_s *m, unsigned int b,
+                   FAR nml_mat *dst);
+int mat_batch_dot(FAR struct mat_batch_s *r, FAR const struct mat_batch_s *m1,
+                  FAR const struct mat_batch_s *m2);
+int mat_batch_dot_many(FAR nml_mat *const *r, FAR nml_mat *const *m1,
+                       FAR nml_mat *const *m2, size_t n);
+
+#endif /* __MAT_BATCH_H */
@@ -0,0 +1,503 @@
+/**
+ * @file mat_bench.c
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ *
+ * @brief Бенчмарки матричных вычислений
+ *
+ * Результаты выводятся в произведениях матриц в секунду, на Cortex-M4
+ * дополнительно в тактах процессора на одно произведение (счетчик DWT)
+ *
+ * @version 0.1
+ * @date 2022-10-05
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libs/nml/nml.h"
+
+#include "denis.h"
+#include "mat_batch.h"
+#include "mat_bench.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* Задачи генерируются и умножаются кусками такого размера */
+
+#define MAT_BENCH_CHUNK        CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_SIZE
+
+#ifdef CONFIG_ARCH_CORTEXM4
+#  define BENCH_HAVE_CYCCNT
+#  define DWT_CTRL             (*(volatile uint32_t *)0xe0001000)
+#  define DWT_CYCCNT           (*(volatile uint32_t *)0xe0001004)
+#  define DEMCR                (*(volatile uint32_t *)0xe000edfc)
+#  define DWT_CTRL_CYCCNTENA   (1 << 0)
+#  define DEMCR_TRCENA         (1 << 24)
+#endif
+
+/* Допустимая ошибка относительно полной шкалы результата 2^qshift:
+ * 2^-MAT_BENCH_TOL_BITS
+ */
+
+#if defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_FLOAT)
+#  define MAT_BENCH_TOL_BITS   (20)
+#elif defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_Q31)
+#  define MAT_BENCH_TOL_BITS   (24)
+#elif defined(CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH_Q15)
+#  define MAT_BENCH_TOL_BITS   (12)
+#else
+#  define MAT_BENCH_TOL_BITS   (40)
+#endif
+
+/* Входные значения от -100 до 100 лежат в пределах +-2^MAT_BENCH_QSHIFT.
+ * В форматах с фиксированной точкой это диапазон пакета из Kconfig
+ */
+
+#ifdef MAT_BATCH_FIXED
+#  define MAT_BENCH_QSHIFT     MAT_BATCH_QSHIFT
+#else
+#  define MAT_BENCH_QSHIFT     (7)
+#endif
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/**
+ * @brief Прочитать счетчик тактов процессора
+ *
+ * При первом вызове включает счетчик DWT CYCCNT. 32-битный счетчик
+ * переполняется за ~25 с при 168 МГц, этого достаточно для одного замера
+ *
+ * @return Значение счетчика, 0 если счетчик недоступен
+ */
+static uint32_t bench_cycles(void)
+{
+#ifdef BENCH_HAVE_CYCCNT
+  if ((DWT_CTRL & DWT_CTRL_CYCCNTENA) == 0)
+    {
+      DEMCR |= DEMCR_TRCENA;
+      DWT_CYCCNT = 0;
+      DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+    }
+
+  return DWT_CYCCNT;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Вывести результат замера
+ *
+ * @param name Название замера
+ * @param nproducts Количество выполненных произведений
+ * @param elapsed Затраченное время, нс
+ * @param cycles Затраченные такты процессора
+ * @return Производительность, произведений в секунду
+ */
+static uint64_t bench_report(FAR const char *name, unsigned int nproducts,
+                             uint64_t elapsed, uint32_t cycles)
+{
+  uint64_t rate;
+
+  if (elapsed == 0)
+    {
+      elapsed = 1;
+    }
+
+  rate = (uint64_t)nproducts * NSEC_PER_SEC / elapsed;
+
+  printf("%-24s %8u products in %10llu us: %10llu products/s",
+         name, nproducts, (unsigned long long)elapsed / 1000,
+         (unsigned long long)rate);
+
+#ifdef BENCH_HAVE_CYCCNT
+  printf(", %lu cycles/product", (unsigned long)(cycles / nproducts));
+#else
+  (void)cycles;
+#endif
+
+  printf("\n");
+
+  return rate;
+}
+
+/**
+ * @brief Вывести ускорение пакетного пути относительно nml
+ *
+ * @param nml Производительность nml_mat_dot(), произведений в секунду
+ * @param batch Производительность пакетного пути, произведений в секунду
+ */
+static void bench_speedup(uint64_t nml, uint64_t batch)
+{
+  if (nml != 0)
+    {
+      printf("%-24s %llu.%llux\n", "  speedup",
+             (unsigned long long)(batch / nml),
+             (unsigned long long)(batch * 10 / nml % 10));
+    }
+}
+
+/**
+ * @brief Создать n пар матриц и матрицы для их произведений
+ *
+ * Размеры генерируются так же, как в task_matrix, от 1 до 5,
+ * или все равны dim, если dim не равен 0
+ *
+ * @param m1 Массив для первых множителей
+ * @param m2 Массив для вторых множителей
+ * @param m3 Массив для результатов
+ * @param n Количество пар
+ * @param dim Размер всех матриц или 0
+ * @return 0 - в случае успеха, -ENOMEM в ином случае
+ */
+static int bench_gen(FAR nml_mat **m1, FAR nml_mat **m2, FAR nml_mat **m3,
+                     unsigned int n, unsigned int dim)
+{
+  unsigned int x;
+
+  for (x = 0; x < n; x++)
+    {
+      unsigned int nrows = dim ? dim : nml_rand_interval(1, 6);
+      unsigned int ninner = dim ? dim : nml_rand_interval(1, 6);
+      unsigned int ncols = dim ? dim : nml_rand_interval(1, 6);
+
+      m1[x] = nml_mat_rnd(nrows, ninner, -100.0, 100.0);
+      m2[x] = nml_mat_rnd(ninner, ncols, -100.0, 100.0);
+      m3[x] = nml_mat_new(nrows, ncols);
+      if (m1[x] == NULL || m2[x] == NULL || m3[x] == NULL)
+        {
+          return -ENOMEM;
+        }
+    }
+
+  return OK;
+}
+
+/**
+ * @brief Освободить матрицы, созданные bench_gen()
+ *
+ * @param m1 Массив первых множителей
+ * @param m2 Массив вторых множителей
+ * @param m3 Массив результатов
+ * @param n Количество пар
+ */
+static void bench_free(FAR nml_mat **m1, FAR nml_mat **m2, FAR nml_mat **m3,
+                       unsigned int n)
+{
+  unsigned int x;
+
+  for (x = 0; x < n; x++)
+    {
+      if (m1[x] != NULL)
+        {
+          nml_mat_free(m1[x]);
+          m1[x] = NULL;
+        }
+
+      if (m2[x] != NULL)
+        {
+          nml_mat_free(m2[x]);
+          m2[x] = NULL;
+        }
+
+      if (m3[x] != NULL)
+        {
+          nml_mat_free(m3[x]);
+          m3[x] = NULL;
+        }
+    }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Сравнить поматричное и пакетное умножение маленьких матриц
+ *
+ * Задачи генерируются и умножаются кусками по MAT_BATCH_SIZE пар, чтобы
+ * бенчмарк помещался в RAM STM32F4 при любом количестве произведений.
+ * Время генерации в замеры не входит, оба пути работают с одними и
+ * теми же матрицами:
+ * 1. nml_mat_dot() + nml_mat_free() для каждой пары случайного размера
+ * 2. mat_batch_dot_many() для тех же пар (группировка + упаковка)
+ * 3. nml_mat_dot() + nml_mat_free() для пар 5x5 * 5x5
+ * 4. mat_batch_dot() для тех же пар 5x5, уже лежащих в SoA
+ *
+ * @param nproducts Количество произведений в каждом замере
+ * @return 0 - в случае успеха, отрицательное значение в ином случае
+ */
+int mat_bench_gemm(unsigned int nproducts)
+{
+  FAR nml_mat *m1[MAT_BENCH_CHUNK];
+  FAR nml_mat *m2[MAT_BENCH_CHUNK];
+  FAR nml_mat *m3[MAT_BENCH_CHUNK];
+  struct mat_batch_s a;
+  struct mat_batch_s b;
+  struct mat_batch_s r;
+  uint64_t elapsed[2] =
+  {
+    0
+  };
+
+  uint32_t cycles[2] =
+  {
+    0
+  };
+
+  uint64_t nml;
+  uint64_t start;
+  uint32_t cycle;
+  unsigned int done;
+  unsigned int n;
+  unsigned int x;
+  int ret;
+
+  memset(m1, 0, sizeof(m1));
+  memset(m2, 0, sizeof(m2));
+  memset(m3, 0, sizeof(m3));
+  a.data = b.data = r.data = NULL;
+
+  srand(time(NULL));
+
+  printf("GEMM benchmark, %u products, batch size %d, batch type %s\n",
+         nproducts, MAT_BENCH_CHUNK, MAT_BATCH_TYPE_NAME);
+
+  // 1, 2. Случайные размеры от 1 до 5
+
+  for (done = 0; done < nproducts; done += n)
+    {
+      n = nproducts - done < MAT_BENCH_CHUNK ?
+          nproducts - done : MAT_BENCH_CHUNK;
+
+      ret = bench_gen(m1, m2, m3, n, 0);
+      if (ret < 0)
+        {
+          goto out;
+        }
+
+      start = denis_timestamp();
+      cycle = bench_cycles();
+      for (x = 0; x < n; x++)
+        {
+          nml_mat_free(nml_mat_dot(m1[x], m2[x]));
+        }
+
+      cycles[0] += bench_cycles() - cycle;
+      elapsed[0] += denis_timestamp() - start;
+
+      start = denis_timestamp();
+      cycle = bench_cycles();
+      ret = mat_batch_dot_many(m3, m1, m2, n);
+      cycles[1] += bench_cycles() - cycle;
+      elapsed[1] += denis_timestamp() - start;
+
+      bench_free(m1, m2, m3, n);
+
+      if (ret < 0)
+        {
+          goto out;
+        }
+    }
+
+  nml = bench_report("nml_mat_dot 1..5", nproducts, elapsed[0], cycles[0]);
+  bench_speedup(nml, bench_report("mat_batch_dot_many 1..5", nproducts,
+                                  elapsed[1], cycles[1]));
+
+  // 3, 4. Один кусок пар 5x5, умножаемый по кругу
+
+  ret = bench_gen(m1, m2, m3, MAT_BENCH_CHUNK, MAT_BATCH_MAX_DIM);
+  if (ret == OK)
+    {
+      ret = mat_batch_init(&a, MAT_BATCH_MAX_DIM, MAT_BATCH_MAX_DIM,
+                           MAT_BENCH_CHUNK);
+    }
+
+  if (ret == OK)
+    {
+      ret = mat_batch_init(&b, MAT_BATCH_MAX_DIM, MAT_BATCH_MAX_DIM,
+                           MAT_BENCH_CHUNK);
+    }
+
+  if (ret == OK)
+    {
+      ret = mat_batch_init(&r, MAT_BATCH_MAX_DIM, MAT_BATCH_MAX_DIM,
+                           MAT_BENCH_CHUNK);
+    }
+
+  if (ret < 0)
+    {
+      goto out;
+    }
+
+  for (x = 0; x < MAT_BENCH_CHUNK; x++)
+    {
+      mat_batch_set(&a, x, m1[x]);
+      mat_batch_set(&b, x, m2[x]);
+    }
+
+  memset(elapsed, 0, sizeof(elapsed));
+  memset(cycles, 0, sizeof(cycles));
+
+  for (done = 0; done < nproducts; done += n)
+    {
+      n = nproducts - done < MAT_BENCH_CHUNK ?
+          nproducts - done : MAT_BENCH_CHUNK;
+
+      start = denis_timestamp();
+      cycle = bench_cycles();
+      for (x = 0; x < n; x++)
+        {
+          nml_mat_free(nml_mat_dot(m1[x], m2[x]));
+        }
+
+      cycles[0] += bench_cycles() - cycle;
+      elapsed[0] += denis_timestamp() - start;
+
+      a.count = b.count = r.count = n;
+
+      start = denis_timestamp();
+      cycle = bench_cycles();
+      mat_batch_dot(&r, &a, &b);
+      cycles[1] += bench_cycles() - cycle;
+      elapsed[1] += denis_timestamp() - start;
+    }
+
+  nml = bench_report("nml_mat_dot 5x5", nproducts, elapsed[0], cycles[0]);
+  bench_speedup(nml, bench_report("mat_batch_dot 5x5", nproducts,
+                                  elapsed[1], cycles[1]));
+
+out:
+  if (ret == -ENOMEM)
+    {
+      printf("%s: Out of memory\n", __func__);
+    }
+
+  mat_batch_free(&a);
+  mat_batch_free(&b);
+  mat_batch_free(&r);
+  bench_free(m1, m2, m3, MAT_BENCH_CHUNK);
+
+  return ret;
+}
+
+/**
+ * @brief Проверить точность пакетного умножения относительно double
+ *
+ * Пары матриц случайного размера со значениями от -100 до 100
+ * умножаются через nml_mat_dot() (эталон в double) и через
+ * mat_batch_dot_many() в выбранном в Kconfig типе элемента кусками по
+ * MAT_BATCH_SIZE пар. Ошибка сравнивается с допуском
+ * 2^-MAT_BENCH_TOL_BITS от полной шкалы результата
+ *
+ * @param nproducts Количество произведений
+ * @return 0 - ошибка в пределах допуска, отрицательное значение
+ *         в ином случае
+ */
+int mat_bench_accuracy(unsigned int nproducts)
+{
+  FAR nml_mat *m1[MAT_BENCH_CHUNK];
+  FAR nml_mat *m2[MAT_BENCH_CHUNK];
+  FAR nml_mat *m3[MAT_BENCH_CHUNK];
+  double full_scale;
+  double tolerance;
+  double max_err = 0.0;
+  double sum_err2 = 0.0;
+  unsigned int nvalues = 0;
+  unsigned int done;
+  unsigned int n;
+  unsigned int x;
+  int ret = OK;
+
+  memset(m1, 0, sizeof(m1));
+  memset(m2, 0, sizeof(m2));
+  memset(m3, 0, sizeof(m3));
+
+  srand(time(NULL));
+
+  for (done = 0; done < nproducts && ret == OK; done += n)
+    {
+      n = nproducts - done < MAT_BENCH_CHUNK ?
+          nproducts - done : MAT_BENCH_CHUNK;
+
+      ret = bench_gen(m1, m2, m3, n, 0);
+      if (ret == OK)
+        {
+          ret = mat_batch_dot_many(m3, m1, m2, n);
+        }
+
+      for (x = 0; x < n && ret == OK; x++)
+        {
+          FAR nml_mat *ref = nml_mat_dot(m1[x], m2[x]);
+          unsigned int i;
+          unsigned int j;
+
+          if (ref == NULL)
+            {
+              ret = -ENOMEM;
+              break;
+            }
+
+          for (i = 0; i < ref->num_rows; i++)
+            {
+              for (j = 0; j < ref->num_cols; j++)
+                {
+                  double err = fabs(m3[x]->data[i][j] - ref->data[i][j]);
+
+                  max_err = err > max_err ? err : max_err;
+                  sum_err2 += err * err;
+                  nvalues++;
+                }
+            }
+
+          nml_mat_free(ref);
+        }
+
+      bench_free(m1, m2, m3, n);
+    }
+
+  if (ret < 0)
+    {
+      goto out;
+    }
+
+  // Полная шкала результата: диапазон входов 2^QSHIFT в квадрате
+  // плюс запас под сумму произведений
+
+  full_scale = ldexp(1.0, 2 * MAT_BENCH_QSHIFT + MAT_BATCH_HEADROOM);
+  tolerance = ldexp(full_scale, -MAT_BENCH_TOL_BITS);
+
+  printf("Accuracy of %s versus double, %u products, %u values:\n",
+         MAT_BATCH_TYPE_NAME, nproducts, nvalues);
+  printf("  max error %g, rms error %g, full scale %g, tolerance %g: %s\n",
+         max_err, nvalues ? sqrt(sum_err2 / nvalues) : 0.0, full_scale,
+         tolerance, max_err <= tolerance ? "PASS" : "FAIL");
+
+  ret = max_err <= tolerance ? OK : -EDOM;
+
+out:
+  if (ret == -ENOMEM)
+    {
+      printf("%s: Out of memory\n", __func__);
+    }
+
+  return ret;
+}
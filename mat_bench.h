@@ -0,0 +1,28 @@
+/**
+ * @file mat_bench.h
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ * @brief Бенчмарки матричных вычислений
+ * @version 0.1
+ * @date 2022-10-05
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __MAT_BENCH_H
+#define __MAT_BENCH_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+
+/****************************************************************************
+ * Public Function Prototypes
+ ****************************************************************************/
+
+int mat_bench_gemm(unsigned int nproducts);
+int mat_bench_accuracy(unsigned int nproducts);
+
+#endif /* __MAT_BENCH_H */
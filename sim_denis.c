@@ -0,0 +1,686 @@
+/**
+ * @file sim_denis.c
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ *
+ * @brief Симулятор шины SPI и устройства "denis" для сборки sim
+ *
+ * Заменяет stm32_spibus_initialize() на сборке sim, где нет
+ * аппаратного SPI. Реализует spi_dev_s, который:
+ * 1. Моделирует длительность транзакции: частоту SCK с делителем PCLK
+ *    как у STM32 (степень двойки), паузы между словами, время
+ *    установки/удержания CS и стоимость запуска DMA
+ * 2. Работает как приемник "denis": собирает кадр между установкой и
+ *    снятием CS, декодирует и проверяет его
+ *
+ * @version 0.1
+ * @date 2022-10-05
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+
+#include <debug.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <nuttx/arch.h>
+#include <nuttx/clock.h>
+#include <nuttx/semaphore.h>
+#include <nuttx/spi/spi.h>
+#include <nuttx/wdog.h>
+
+#include "denis.h"
+#include "sim_denis.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define SIM_DENIS_PCLK         CONFIG_EXAMPLES_TEST_TASK_SIM_DENIS_PCLK
+#define SIM_DENIS_WORD_GAP     CONFIG_EXAMPLES_TEST_TASK_SIM_DENIS_WORD_GAP_NS
+#define SIM_DENIS_CS_SETUP     CONFIG_EXAMPLES_TEST_TASK_SIM_DENIS_CS_SETUP_NS
+#define SIM_DENIS_CS_HOLD      CONFIG_EXAMPLES_TEST_TASK_SIM_DENIS_CS_HOLD_NS
+#define SIM_DENIS_DMA_SETUP    CONFIG_EXAMPLES_TEST_TASK_SIM_DENIS_DMA_SETUP_NS
+#define SIM_DENIS_DMA_THRESHOLD \
+  CONFIG_EXAMPLES_TEST_TASK_SIM_DENIS_DMA_THRESHOLD
+
+/* Самый большой кадр, который принимает приемник: матрица 5x5 double */
+
+#define SIM_DENIS_FRAME_MAX    (5 * 5 * sizeof(double))
+
+/* Максимальный шаг счетчика между соседними кадрами, с */
+
+#define SIM_DENIS_COUNTER_STEP (60)
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+struct sim_denis_spi_s
+{
+  struct spi_dev_s dev;            /* Externally visible part of the SPI
+                                    * interface */
+  sem_t exclsem;                   /* Held while the bus is locked */
+  uint32_t frequency;              /* Requested frequency */
+  uint32_t actual;                 /* Modelled SCK frequency */
+  int nbits;                       /* Bits per word */
+  bool selected;                   /* CS is asserted */
+  uint32_t pio_ns;                 /* PIO time not yet waited out */
+  uint64_t dma_ns;                 /* DMA time not yet waited out */
+  struct wdog_s dmawd;             /* Models the DMA completion interrupt */
+  sem_t dmasem;                    /* Posted when the DMA completes */
+
+  /* Simulated denis receiver */
+
+  uint8_t frame[SIM_DENIS_FRAME_MAX];
+  size_t framelen;                 /* Bytes received in the current frame */
+  bool overflow;                   /* Current frame exceeds frame[] */
+  time_t last_counter;             /* Last counter value received */
+  uint32_t last_seq;               /* Last timestamped record received */
+  struct sim_denis_stats_s stats;
+};
+
+/****************************************************************************
+ * Private Function Prototypes
+ ****************************************************************************/
+
+static int sim_denis_lock(FAR struct spi_dev_s *dev, bool lock);
+static void sim_denis_select(FAR struct spi_dev_s *dev, uint32_t devid,
+                             bool selected);
+static uint32_t sim_denis_setfrequency(FAR struct spi_dev_s *dev,
+                                       uint32_t frequency);
+static void sim_denis_setmode(FAR struct spi_dev_s *dev,
+                              enum spi_mode_e mode);
+static void sim_denis_setbits(FAR struct spi_dev_s *dev, int nbits);
+static uint8_t sim_denis_status(FAR struct spi_dev_s *dev, uint32_t devid);
+static uint32_t sim_denis_send(FAR struct spi_dev_s *dev, uint32_t wd);
+#ifdef CONFIG_SPI_EXCHANGE
+static void sim_denis_exchange(FAR struct spi_dev_s *dev,
+                               FAR const void *txbuffer,
+                               FAR void *rxbuffer, size_t nwords);
+#else
+static void sim_denis_sndblock(FAR struct spi_dev_s *dev,
+                              FAR const void *buffer, size_t nwords);
+static void sim_denis_recvblock(FAR struct spi_dev_s *dev,
+                               FAR void *buffer, size_t nwords);
+#endif
+static int sim_denis_registercallback(FAR struct spi_dev_s *dev,
+                                      spi_mediachange_t callback,
+                                      FAR void *arg);
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static const struct spi_ops_s g_sim_denis_ops =
+{
+  sim_denis_lock,              /* lock */
+  sim_denis_select,            /* select */
+  sim_denis_setfrequency,      /* setfrequency */
+#ifdef CONFIG_SPI_CS_DELAY_CONTROL
+  NULL,                        /* setdelay */
+#endif
+  sim_denis_setmode,           /* setmode */
+  sim_denis_setbits,           /* setbits */
+#ifdef CONFIG_SPI_HWFEATURES
+  NULL,                        /* hwfeatures */
+#endif
+  sim_denis_status,            /* status */
+#ifdef CONFIG_SPI_CMDDATA
+  NULL,                        /* cmddata */
+#endif
+  sim_denis_send,              /* send */
+#ifdef CONFIG_SPI_EXCHANGE
+  sim_denis_exchange,          /* exchange */
+#else
+  sim_denis_sndblock,          /* sndblock */
+  sim_denis_recvblock,         /* recvblock */
+#endif
+#ifdef CONFIG_SPI_TRIGGER
+  NULL,                        /* trigger */
+#endif
+  sim_denis_registercallback,  /* registercallback */
+};
+
+static struct sim_denis_spi_s g_sim_denis_spi;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * Name: sim_denis_wait
+ ****************************************************************************/
+
+/**
+ * @brief Завершить модельную передачу DMA
+ *
+ * Вызывается сторожевым таймером из прерывания, как обработчик
+ * прерывания DMA в настоящем драйвере
+ *
+ * @param arg Указатель на симулятор шины
+ */
+static void sim_denis_dmadone(wdparm_t arg)
+{
+  FAR struct sim_denis_spi_s *priv = (FAR struct sim_denis_spi_s *)arg;
+
+  nxsem_post(&priv->dmasem);
+}
+
+/**
+ * @brief Выдержать модельное время шины
+ *
+ * Время копится в наносекундах отдельно для программной передачи и DMA,
+ * остаток переносится на следующий вызов. Так суммарное время совпадает
+ * с моделью и для коротких транзакций.
+ *
+ * Программная передача занимает процессор, поэтому ее время
+ * выдерживается целыми микросекундами калиброванным циклом up_udelay().
+ * Во время DMA процессор свободен: как и настоящий драйвер, вызывающий
+ * блокируется на семафоре, который отпускает сторожевой таймер.
+ * Таймер отсчитывает целые тики, поэтому часть DMA короче USEC_PER_TICK
+ * переносится на следующие передачи
+ *
+ * @param priv Указатель на симулятор шины
+ * @param ns Модельное время, нс
+ * @param dma true - передача идет через DMA
+ */
+static void sim_denis_wait(FAR struct sim_denis_spi_s *priv, uint32_t ns,
+                           bool dma)
+{
+  priv->stats.busy_ns += ns;
+
+  if (dma)
+    {
+      uint64_t ticks;
+
+      priv->dma_ns += ns;
+
+      ticks = priv->dma_ns / ((uint64_t)USEC_PER_TICK * NSEC_PER_USEC);
+      priv->dma_ns -= ticks * USEC_PER_TICK * NSEC_PER_USEC;
+
+      if (ticks > 0 &&
+          wd_start(&priv->dmawd, ticks, sim_denis_dmadone,
+                   (wdparm_t)priv) == OK)
+        {
+          nxsem_wait_uninterruptible(&priv->dmasem);
+        }
+    }
+  else
+    {
+      uint32_t us;
+
+      priv->pio_ns += ns;
+
+      us = priv->pio_ns / NSEC_PER_USEC;
+      priv->pio_ns -= us * NSEC_PER_USEC;
+
+      if (us > 0)
+        {
+          up_udelay(us);
+        }
+    }
+}
+
+/****************************************************************************
+ * Name: sim_denis_transfer
+ ****************************************************************************/
+
+/**
+ * @brief Смоделировать передачу блока слов
+ *
+ * Блоки длиннее порога DMA передаются без пауз между словами, но
+ * с накладными расходами на настройку DMA. Короткие блоки передаются
+ * программно с паузой между словами
+ *
+ * @param priv Указатель на симулятор шины
+ * @param nwords Количество слов
+ */
+static void sim_denis_transfer(FAR struct sim_denis_spi_s *priv,
+                               size_t nwords)
+{
+  bool dma = nwords * ((priv->nbits + 7) / 8) > SIM_DENIS_DMA_THRESHOLD;
+  uint64_t ns;
+
+  ns = (uint64_t)nwords * priv->nbits * NSEC_PER_SEC / priv->actual;
+  ns += dma ? SIM_DENIS_DMA_SETUP : (uint64_t)nwords * SIM_DENIS_WORD_GAP;
+
+  sim_denis_wait(priv, ns > UINT32_MAX ? UINT32_MAX : ns, dma);
+}
+
+/****************************************************************************
+ * Name: sim_denis_receive
+ ****************************************************************************/
+
+/**
+ * @brief Принять байты кадра в симулируемом устройстве denis
+ *
+ * @param priv Указатель на симулятор шины
+ * @param data Указатель на данные
+ * @param len Длина данных в байтах
+ */
+static void sim_denis_receive(FAR struct sim_denis_spi_s *priv,
+                              FAR const void *data, size_t len)
+{
+  size_t room = sizeof(priv->frame) - priv->framelen;
+
+  if (!priv->selected)
+    {
+      /* Устройство не выбрано и не слушает шину */
+
+      return;
+    }
+
+  if (len > room)
+    {
+      priv->overflow = true;
+      len = room;
+    }
+
+  memcpy(priv->frame + priv->framelen, data, len);
+  priv->framelen += len;
+  priv->stats.bytes += len;
+}
+
+/****************************************************************************
+ * Name: sim_denis_decode
+ ****************************************************************************/
+
+/**
+ * @brief Декодировать и проверить принятый кадр
+ *
+ * Кадр счетчика - значение time_t, которое продолжает последовательность
+ * (шаг от 0 до SIM_DENIS_COUNTER_STEP), или запись denis_tstamp_s,
+ * номера которых идут подряд. Первый кадр счетчика начинает
+ * последовательность. Кадр матрицы - от 1 до 25 конечных значений double.
+ *
+ * Кадры не содержат заголовка, поэтому при sizeof(time_t) ==
+ * sizeof(double) кадр счетчика совпадает по длине с матрицей 1x1.
+ * Кадр, который не продолжает последовательность, считается матрицей
+ * только если его значение - нормальное число double. Значения time_t
+ * меньше 2^52 в виде double денормализованы, поэтому счетчик, который
+ * ушел назад или прыгнул, считается ошибкой, а не матрицей
+ *
+ * @param priv Указатель на симулятор шины
+ */
+static void sim_denis_decode(FAR struct sim_denis_spi_s *priv)
+{
+  size_t len = priv->framelen;
+  size_t i;
+
+  priv->stats.frames++;
+
+  if (priv->overflow || len == 0)
+    {
+      spierr("ERROR: Bad frame length %zu%s\n", len,
+             priv->overflow ? "+" : "");
+      priv->stats.errors++;
+      return;
+    }
+
+  if (len == sizeof(struct denis_tstamp_s))
+    {
+      struct denis_tstamp_s rec;
+
+      memcpy(&rec, priv->frame, sizeof(rec));
+      if (rec.magic == DENIS_TSTAMP_MAGIC)
+        {
+          if (priv->stats.counters != 0 && rec.seq != priv->last_seq + 1)
+            {
+              spierr("ERROR: Counter record %lu after %lu\n",
+                     (unsigned long)rec.seq, (unsigned long)priv->last_seq);
+              priv->stats.errors++;
+            }
+          else
+            {
+              priv->stats.counters++;
+            }
+
+          priv->last_seq = rec.seq;
+          return;
+        }
+    }
+
+  if (len == sizeof(time_t))
+    {
+      time_t counter;
+      bool matrix = false;
+
+      memcpy(&counter, priv->frame, sizeof(counter));
+      if (priv->stats.counters != 0 && counter >= priv->last_counter &&
+          counter - priv->last_counter <= SIM_DENIS_COUNTER_STEP)
+        {
+          priv->last_counter = counter;
+          priv->stats.counters++;
+          return;
+        }
+
+      if (len == sizeof(double))
+        {
+          double value;
+
+          memcpy(&value, priv->frame, sizeof(value));
+          matrix = fpclassify(value) == FP_NORMAL;
+        }
+
+      if (!matrix)
+        {
+          if (priv->stats.counters == 0)
+            {
+              priv->last_counter = counter;
+              priv->stats.counters++;
+              return;
+            }
+
+          spierr("ERROR: Counter out of sequence: %ld -> %ld\n",
+                 (long)priv->last_counter, (long)counter);
+          priv->stats.errors++;
+          return;
+        }
+    }
+
+  if (len % sizeof(double) != 0)
+    {
+      spierr("ERROR: Unknown frame of %zu bytes\n", len);
+      priv->stats.errors++;
+      return;
+    }
+
+  for (i = 0; i < len; i += sizeof(double))
+    {
+      double value;
+
+      memcpy(&value, priv->frame + i, sizeof(value));
+      if (!isfinite(value))
+        {
+          spierr("ERROR: Matrix element %zu is not finite\n",
+                 i / sizeof(double));
+          priv->stats.errors++;
+          return;
+        }
+    }
+
+  priv->stats.matrices++;
+}
+
+/****************************************************************************
+ * Name: sim_denis_lock
+ ****************************************************************************/
+
+static int sim_denis_lock(FAR struct spi_dev_s *dev, bool lock)
+{
+  FAR struct sim_denis_spi_s *priv = (FAR struct sim_denis_spi_s *)dev;
+
+  if (lock)
+    {
+      return nxsem_wait_uninterruptible(&priv->exclsem);
+    }
+
+  return nxsem_post(&priv->exclsem);
+}
+
+/****************************************************************************
+ * Name: sim_denis_select
+ ****************************************************************************/
+
+/**
+ * @brief Установить или снять CS
+ *
+ * Установка CS начинает новый кадр, снятие - завершает и проверяет его
+ */
+static void sim_denis_select(FAR struct spi_dev_s *dev, uint32_t devid,
+                             bool selected)
+{
+  FAR struct sim_denis_spi_s *priv = (FAR struct sim_denis_spi_s *)dev;
+
+  if (selected == priv->selected)
+    {
+      return;
+    }
+
+  if (selected)
+    {
+      priv->selected = true;
+      priv->framelen = 0;
+      priv->overflow = false;
+      sim_denis_wait(priv, SIM_DENIS_CS_SETUP, false);
+    }
+  else
+    {
+      sim_denis_wait(priv, SIM_DENIS_CS_HOLD, false);
+      priv->selected = false;
+      sim_denis_decode(priv);
+    }
+}
+
+/****************************************************************************
+ * Name: sim_denis_setfrequency
+ ****************************************************************************/
+
+/**
+ * @brief Установить частоту SCK
+ *
+ * Как и у STM32, частота получается делением PCLK на степень двойки
+ * от 2 до 256 и не превышает запрошенную
+ */
+static uint32_t sim_denis_setfrequency(FAR struct spi_dev_s *dev,
+                                       uint32_t frequency)
+{
+  FAR struct sim_denis_spi_s *priv = (FAR struct sim_denis_spi_s *)dev;
+  uint32_t divider = 2;
+
+  while (divider < 256 && SIM_DENIS_PCLK / divider > frequency)
+    {
+      divider <<= 1;
+    }
+
+  priv->frequency = frequency;
+  priv->actual    = SIM_DENIS_PCLK / divider;
+
+  spiinfo("Frequency %lu->%lu\n", (unsigned long)frequency,
+          (unsigned long)priv->actual);
+
+  return priv->actual;
+}
+
+/****************************************************************************
+ * Name: sim_denis_setmode
+ ****************************************************************************/
+
+static void sim_denis_setmode(FAR struct spi_dev_s *dev,
+                              enum spi_mode_e mode)
+{
+  /* Режим SPI не влияет на модель времени */
+
+  if (mode != DENIS_SPI_MODE)
+    {
+      spiwarn("WARNING: denis expects mode %d, got %d\n",
+              DENIS_SPI_MODE, mode);
+    }
+}
+
+/****************************************************************************
+ * Name: sim_denis_setbits
+ ****************************************************************************/
+
+static void sim_denis_setbits(FAR struct spi_dev_s *dev, int nbits)
+{
+  FAR struct sim_denis_spi_s *priv = (FAR struct sim_denis_spi_s *)dev;
+
+  DEBUGASSERT(nbits == 8 || nbits == 16);
+  priv->nbits = nbits;
+}
+
+/****************************************************************************
+ * Name: sim_denis_status
+ ****************************************************************************/
+
+static uint8_t sim_denis_status(FAR struct spi_dev_s *dev, uint32_t devid)
+{
+  return SPI_STATUS_PRESENT;
+}
+
+/****************************************************************************
+ * Name: sim_denis_send
+ ****************************************************************************/
+
+static uint32_t sim_denis_send(FAR struct spi_dev_s *dev, uint32_t wd)
+{
+  FAR struct sim_denis_spi_s *priv = (FAR struct sim_denis_spi_s *)dev;
+
+  if (priv->nbits > 8)
+    {
+      uint16_t word = wd;
+      sim_denis_receive(priv, &word, sizeof(word));
+    }
+  else
+    {
+      uint8_t word = wd;
+      sim_denis_receive(priv, &word, sizeof(word));
+    }
+
+  sim_denis_transfer(priv, 1);
+
+  /* Устройство только принимает данные, MISO подтянут к 1 */
+
+  return priv->nbits > 8 ? 0xffff : 0xff;
+}
+
+#ifdef CONFIG_SPI_EXCHANGE
+/****************************************************************************
+ * Name: sim_denis_exchange
+ ****************************************************************************/
+
+static void sim_denis_exchange(FAR struct spi_dev_s *dev,
+                               FAR const void *txbuffer,
+                               FAR void *rxbuffer, size_t nwords)
+{
+  FAR struct sim_denis_spi_s *priv = (FAR struct sim_denis_spi_s *)dev;
+  size_t len = nwords * (priv->nbits > 8 ? 2 : 1);
+
+  if (txbuffer != NULL)
+    {
+      sim_denis_receive(priv, txbuffer, len);
+    }
+
+  if (rxbuffer != NULL)
+    {
+      memset(rxbuffer, 0xff, len);
+    }
+
+  sim_denis_transfer(priv, nwords);
+}
+#else
+/****************************************************************************
+ * Name: sim_denis_sndblock
+ ****************************************************************************/
+
+static void sim_denis_sndblock(FAR struct spi_dev_s *dev,
+                              FAR const void *buffer, size_t nwords)
+{
+  FAR struct sim_denis_spi_s *priv = (FAR struct sim_denis_spi_s *)dev;
+
+  sim_denis_receive(priv, buffer, nwords * (priv->nbits > 8 ? 2 : 1));
+  sim_denis_transfer(priv, nwords);
+}
+
+/****************************************************************************
+ * Name: sim_denis_recvblock
+ ****************************************************************************/
+
+static void sim_denis_recvblock(FAR struct spi_dev_s *dev,
+                               FAR void *buffer, size_t nwords)
+{
+  FAR struct sim_denis_spi_s *priv = (FAR struct sim_denis_spi_s *)dev;
+
+  memset(buffer, 0xff, nwords * (priv->nbits > 8 ? 2 : 1));
+  sim_denis_transfer(priv, nwords);
+}
+#endif
+
+/****************************************************************************
+ * Name: sim_denis_registercallback
+ ****************************************************************************/
+
+static int sim_denis_registercallback(FAR struct spi_dev_s *dev,
+                                      spi_mediachange_t callback,
+                                      FAR void *arg)
+{
+  return -ENOSYS;
+}
+
+/****************************************************************************
+ * Name: sim_denis_spibus_initialize
+ ****************************************************************************/
+
+/**
+ * @brief Инициализировать симулируемую шину SPI
+ *
+ * @return Указатель на интерфейс SPI
+ */
+static FAR struct spi_dev_s *sim_denis_spibus_initialize(void)
+{
+  FAR struct sim_denis_spi_s *priv = &g_sim_denis_spi;
+
+  memset(priv, 0, sizeof(*priv));
+  priv->dev.ops = &g_sim_denis_ops;
+  priv->nbits   = 8;
+  nxsem_init(&priv->exclsem, 0, 1);
+
+  // Семафор завершения DMA используется для сигнализации и не должен
+  // наследовать приоритет
+
+  nxsem_init(&priv->dmasem, 0, 0);
+  nxsem_set_protocol(&priv->dmasem, SEM_PRIO_NONE);
+
+  sim_denis_setfrequency(&priv->dev, DENIS_SPI_FREQUENCY);
+
+  return &priv->dev;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Инициализируем симулятор шины и регистрируем устройство
+ *
+ * @param busno Номер шины, не используется
+ * @return 0 - в случае успеха, отрицательное значение в ином случае
+ */
+int board_denis_initialize(int busno)
+{
+    static struct denis_config_s denis0_config;
+    struct spi_dev_s *spi;
+
+    sninfo("Initializing simulated Denis\n");
+
+    spi = sim_denis_spibus_initialize();
+
+    // Регистрируем устройство в системе по пути "dev/denis0"
+    FAR const char *devpath = "/dev/denis0";
+    return denis_register(devpath, spi, &denis0_config);
+}
+
+/**
+ * @brief Получить статистику симулируемого устройства
+ *
+ * @param stats Указатель на структуру для статистики
+ */
+void sim_denis_stats(FAR struct sim_denis_stats_s *stats)
+{
+  FAR struct sim_denis_spi_s *priv = &g_sim_denis_spi;
+
+  nxsem_wait_uninterruptible(&priv->exclsem);
+  *stats = priv->stats;
+  nxsem_post(&priv->exclsem);
+}
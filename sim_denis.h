@@ -0,0 +1,59 @@
+/**
+ * @file sim_denis.h
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ * @brief Симулятор шины SPI и устройства "denis" для сборки sim
+ * @version 0.1
+ * @date 2022-10-05
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#ifndef __SIM_DENIS_H
+#define __SIM_DENIS_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+
+#include <stdint.h>
+
+/****************************************************************************
+ * Public Types
+ ****************************************************************************/
+
+/* Статистика симулируемого приемника denis */
+
+struct sim_denis_stats_s
+{
+  uint32_t frames;           /* Frames received (CS asserted..released) */
+  uint32_t bytes;            /* Bytes received */
+  uint32_t counters;         /* Valid counter frames */
+  uint32_t matrices;         /* Valid matrix frames */
+  uint32_t errors;           /* Frames that failed validation */
+  uint64_t busy_ns;          /* Modelled bus time */
+};
+
+#ifdef __cplusplus
+#define EXTERN extern "C"
+extern "C"
+{
+#else
+#define EXTERN extern
+#endif
+
+/****************************************************************************
+ * Public Function Prototypes
+ ****************************************************************************/
+
+int board_denis_initialize(int busno);
+void sim_denis_stats(FAR struct sim_denis_stats_s *stats);
+
+#undef EXTERN
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SIM_DENIS_H */
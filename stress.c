@@ -0,0 +1,403 @@
+/**
+ * @file stress.c
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ *
+ * @brief Генератор нагрузки на устройство "denis"
+ *
+ * Запускает N задач-производителей, которые пишут в устройство записи
+ * заданного размера с заданной суммарной частотой. Частота ступенчато
+ * увеличивается, на каждой ступени выводится достигнутая производительность
+ * относительно предложенной и задержка записи. Работа завершается, когда
+ * драйвер перестает успевать за предложенной нагрузкой (насыщение).
+ *
+ * Темп задается через nanosleep(), разрешение которого равно
+ * USEC_PER_TICK. Поэтому генератор требует SCHED_TICKLESS и не запускает
+ * ступени с периодом короче этого разрешения: на них недобор нагрузки
+ * вызван таймером, а не драйвером.
+ *
+ * @version 0.1
+ * @date 2022-10-05
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+#include <nuttx/clock.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "denis.h"
+#include "stress.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define STRESS_STACKSIZE       CONFIG_EXAMPLES_TEST_TASK_STRESS_STACKSIZE
+
+/* Ступень считается насыщенной, если достигнуто меньше этой доли
+ * предложенной нагрузки, %
+ */
+
+#define STRESS_SATURATION_PCT  (90)
+
+/* Разрешение nanosleep(), которым производители выдерживают темп, нс */
+
+#define STRESS_RESOLUTION_NS   ((uint64_t)USEC_PER_TICK * NSEC_PER_USEC)
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+struct stress_stats_s
+{
+  uint32_t records;          /* Records written */
+  uint32_t errors;           /* Failed writes */
+  uint64_t lat_sum;          /* Sum of latencies, ns */
+  uint32_t lat_min;          /* Minimum latency, ns */
+  uint32_t lat_max;          /* Maximum latency, ns */
+};
+
+struct stress_state_s
+{
+  FAR const struct stress_config_s *cfg;
+  volatile bool running;     /* Producers keep running while set */
+  volatile uint32_t period;  /* Period of every producer, ns */
+  sem_t lock;                /* Protects stats and failed */
+  sem_t ready;               /* Posted by every producer after setup */
+  sem_t exited;              /* Posted by every exiting producer */
+  unsigned int failed;       /* Producers that failed to start */
+  struct stress_stats_s stats;
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct stress_state_s g_stress;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/**
+ * @brief Сбросить статистику ступени
+ */
+static void stress_reset_stats(void)
+{
+  sem_wait(&g_stress.lock);
+
+  memset(&g_stress.stats, 0, sizeof(g_stress.stats));
+  g_stress.stats.lat_min = UINT32_MAX;
+
+  sem_post(&g_stress.lock);
+}
+
+/**
+ * @brief Задача-производитель
+ *
+ * Пишет записи в устройство с периодом g_stress.period. Задержка
+ * записи считается от запланированного момента отправки до завершения
+ * write(), то есть включает ожидание в очереди к драйверу
+ *
+ * @param argc Количество аргументов
+ * @param argv argv[1] - номер производителя
+ * @return int Результат выполнения
+ */
+static int stress_producer(int argc, char *argv[])
+{
+  FAR const struct stress_config_s *cfg = g_stress.cfg;
+  FAR uint8_t *payload;
+  uint64_t next;
+  int id = atoi(argv[1]);
+  int ret = EXIT_SUCCESS;
+  int fd;
+
+  payload = malloc(cfg->payload);
+  fd = open(cfg->devpath, O_WRONLY);
+  if (payload == NULL || fd < 0)
+    {
+      printf("%s %d: Failed to start: %d\n", __func__, id, errno);
+
+      sem_wait(&g_stress.lock);
+      g_stress.failed++;
+      sem_post(&g_stress.lock);
+
+      sem_post(&g_stress.ready);
+      ret = EXIT_FAILURE;
+      goto out;
+    }
+
+  memset(payload, id, cfg->payload);
+  sem_post(&g_stress.ready);
+
+  next = denis_timestamp();
+
+  while (g_stress.running)
+    {
+      uint64_t now = denis_timestamp();
+      uint64_t latency;
+      ssize_t nbytes;
+
+      if (next > now)
+        {
+          struct timespec ts;
+
+          ts.tv_sec  = (next - now) / NSEC_PER_SEC;
+          ts.tv_nsec = (next - now) % NSEC_PER_SEC;
+          nanosleep(&ts, NULL);
+        }
+
+      nbytes = write(fd, payload, cfg->payload);
+      now = denis_timestamp();
+      latency = now - next;
+
+      sem_wait(&g_stress.lock);
+
+      if (nbytes == cfg->payload)
+        {
+          g_stress.stats.records++;
+          g_stress.stats.lat_sum += latency;
+
+          if (latency > UINT32_MAX)
+            {
+              latency = UINT32_MAX;
+            }
+
+          if (latency < g_stress.stats.lat_min)
+            {
+              g_stress.stats.lat_min = latency;
+            }
+
+          if (latency > g_stress.stats.lat_max)
+            {
+              g_stress.stats.lat_max = latency;
+            }
+        }
+      else
+        {
+          g_stress.stats.errors++;
+        }
+
+      sem_post(&g_stress.lock);
+
+      // Если производитель отстал больше чем на период, не пытаемся
+      // догнать расписание пачкой записей: это уже насыщение
+
+      next += g_stress.period;
+      if (next + g_stress.period < now)
+        {
+          next = now;
+        }
+    }
+
+out:
+  if (fd >= 0)
+    {
+      close(fd);
+    }
+
+  free(payload);
+  sem_post(&g_stress.exited);
+
+  return ret;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Заполнить конфигурацию значениями из Kconfig
+ *
+ * @param cfg Указатель на конфигурацию
+ * @param devpath Путь к устройству
+ */
+void stress_default_config(FAR struct stress_config_s *cfg,
+                           FAR const char *devpath)
+{
+  cfg->devpath    = devpath;
+  cfg->nproducers = CONFIG_EXAMPLES_TEST_TASK_STRESS_PRODUCERS;
+  cfg->payload    = CONFIG_EXAMPLES_TEST_TASK_STRESS_PAYLOAD;
+  cfg->rate_start = CONFIG_EXAMPLES_TEST_TASK_STRESS_RATE_START;
+  cfg->rate_step  = CONFIG_EXAMPLES_TEST_TASK_STRESS_RATE_STEP;
+  cfg->nsteps     = CONFIG_EXAMPLES_TEST_TASK_STRESS_STEPS;
+  cfg->step_ms    = CONFIG_EXAMPLES_TEST_TASK_STRESS_STEP_MS;
+  cfg->priority   = CONFIG_EXAMPLES_TEST_TASK_STRESS_PRIORITY;
+}
+
+/**
+ * @brief Запустить ступенчатый нагрузочный тест
+ *
+ * Вызывающая задача управляет ступенями и выводит результаты, поэтому
+ * ее приоритет должен быть не ниже приоритета производителей
+ *
+ * Период производителя хранится в 32 битах, чтобы производители читали
+ * его атомарно, поэтому начальная частота должна быть не ниже
+ * nproducers / 4.29 записей в секунду
+ *
+ * @param cfg Конфигурация теста
+ * @return 0 - в случае успеха, отрицательное значение в ином случае
+ */
+int stress_run(FAR const struct stress_config_s *cfg)
+{
+  unsigned int nstarted = 0;
+  unsigned int nready;
+  unsigned int step;
+  uint64_t period;
+  int ret = OK;
+
+  if (cfg->nproducers == 0 || cfg->payload == 0 || cfg->rate_start == 0 ||
+      cfg->step_ms == 0)
+    {
+      return -EINVAL;
+    }
+
+  // Частота только растет от ступени к ступени, поэтому самый длинный
+  // период - на первой ступени
+
+  period = (uint64_t)cfg->nproducers * NSEC_PER_SEC / cfg->rate_start;
+  if (period > UINT32_MAX)
+    {
+      printf("Stress: %u records/s is too low for %u producers\n",
+             cfg->rate_start, cfg->nproducers);
+      return -EINVAL;
+    }
+
+  memset(&g_stress, 0, sizeof(g_stress));
+  g_stress.cfg     = cfg;
+  g_stress.running = true;
+  g_stress.period  = period;
+  sem_init(&g_stress.lock, 0, 1);
+  sem_init(&g_stress.ready, 0, 0);
+  sem_init(&g_stress.exited, 0, 0);
+
+  printf("Stress: %u producers, %zu bytes/record, priority %d\n",
+         cfg->nproducers, cfg->payload, cfg->priority);
+  printf("%10s %10s %10s %10s %10s %10s %10s\n",
+         "offered/s", "achieved/s", "KiB/s", "avg us", "min us",
+         "max us", "errors");
+
+  for (; nstarted < cfg->nproducers; nstarted++)
+    {
+      char id[12];
+      FAR char *argv[2];
+
+      snprintf(id, sizeof(id), "%u", nstarted);
+      argv[0] = id;
+      argv[1] = NULL;
+
+      if (task_create("stress_producer", cfg->priority, STRESS_STACKSIZE,
+                      stress_producer, argv) < 0)
+        {
+          printf("Failed to start stress_producer: %d\n", errno);
+          ret = -errno;
+          goto out;
+        }
+    }
+
+  // Дожидаемся, пока все производители откроют устройство. Если хотя бы
+  // один не запустился, результат не отражает возможности драйвера
+
+  for (nready = 0; nready < nstarted; nready++)
+    {
+      sem_wait(&g_stress.ready);
+    }
+
+  if (g_stress.failed > 0)
+    {
+      printf("Stress: %u of %u producers failed to start\n",
+             g_stress.failed, nstarted);
+      ret = -EIO;
+      goto out;
+    }
+
+  for (step = 0; step < cfg->nsteps; step++)
+    {
+      struct stress_stats_s stats;
+      unsigned int offered = cfg->rate_start + step * cfg->rate_step;
+      uint64_t start;
+      uint64_t elapsed;
+      uint32_t achieved;
+
+      // Суммарная нагрузка делится поровну между производителями. Период
+      // короче разрешения таймера производители не выдержат, и недобор
+      // был бы ошибочно принят за насыщение драйвера
+
+      period = (uint64_t)cfg->nproducers * NSEC_PER_SEC / offered;
+      if (period < STRESS_RESOLUTION_NS)
+        {
+          printf("Stopped at %u records/s offered: period %lu ns is below "
+                 "the timer resolution %lu ns, driver not saturated\n",
+                 offered, (unsigned long)period,
+                 (unsigned long)STRESS_RESOLUTION_NS);
+          break;
+        }
+
+      g_stress.period = period;
+      stress_reset_stats();
+
+      start = denis_timestamp();
+      usleep(cfg->step_ms * 1000);
+
+      sem_wait(&g_stress.lock);
+      elapsed = denis_timestamp() - start;
+      stats = g_stress.stats;
+      sem_post(&g_stress.lock);
+
+      achieved = (uint64_t)stats.records * NSEC_PER_SEC / elapsed;
+
+      printf("%10u %10lu %10lu %10lu %10lu %10lu %10lu\n",
+             offered, (unsigned long)achieved,
+             (unsigned long)((uint64_t)achieved * cfg->payload / 1024),
+             (unsigned long)(stats.records ?
+                             stats.lat_sum / stats.records / 1000 : 0),
+             (unsigned long)(stats.records ? stats.lat_min / 1000 : 0),
+             (unsigned long)(stats.lat_max / 1000),
+             (unsigned long)stats.errors);
+
+      if ((uint64_t)achieved * 100 < (uint64_t)offered * STRESS_SATURATION_PCT)
+        {
+          printf("Saturated at %u records/s offered, %lu achieved\n",
+                 offered, (unsigned long)achieved);
+          break;
+        }
+    }
+
+  if (step == cfg->nsteps)
+    {
+      printf("Not saturated after %u steps\n", cfg->nsteps);
+    }
+
+out:
+
+  // Останавливаем производителей и дожидаемся их завершения
+
+  g_stress.running = false;
+
+  while (nstarted-- > 0)
+    {
+      sem_wait(&g_stress.exited);
+    }
+
+  sem_destroy(&g_stress.lock);
+  sem_destroy(&g_stress.ready);
+  sem_destroy(&g_stress.exited);
+
+  return ret;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file stress.h
+ * @author Denis Shreiber (chuyecd@gmail.com)
+ * @brief Генератор нагрузки на устройство "denis"
+ * @version 0.1
+ * @date 2022-10-05
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __STRESS_H
+#define __STRESS_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <nuttx/config.h>
+
+#include <stddef.h>
+
+/****************************************************************************
+ * Public Types
+ ****************************************************************************/
+
+struct stress_config_s
+{
+  FAR const char *devpath;   /* Device to write to */
+  unsigned int nproducers;   /* Number of producer tasks */
+  size_t payload;            /* Bytes per record */
+  unsigned int rate_start;   /* Offered load of the first step, records/s */
+  unsigned int rate_step;    /* Offered load increment per step, records/s */
+  unsigned int nsteps;       /* Maximum number of steps */
+  unsigned int step_ms;      /* Duration of every step, ms */
+  int priority;              /* Priority of the producer tasks */
+};
+
+/****************************************************************************
+ * Public Function Prototypes
+ ****************************************************************************/
+
+void stress_default_config(FAR struct stress_config_s *cfg,
+                           FAR const char *devpath);
+int stress_run(FAR const struct stress_config_s *cfg);
+
+#endif /* __STRESS_H */
@@ -8,13 +8,38 @@
 
 #include <nuttx/config.h>
 
+#include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #include "libs/nml/nml.h"
 
-#include "stm32_denis.h"
+#include "denis.h"
+#ifdef CONFIG_ARCH_SIM
+#  include "sim_denis.h"
+#else
+#  include "stm32_denis.h"
+#endif
+
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_CAPTURE
+#  include "denis_replay.h"
+#endif
+
+#ifdef CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH
+#  include "mat_bench.h"
+#endif
+
+#ifdef CONFIG_EXAMPLES_TEST_TASK_STRESS
+#  include "stress.h"
+#endif
 
 /****************************************************************************
  * Pre-processor Definitions
@@ -34,10 +59,87 @@
 
 #define DENIS_DEVNAME    "/dev/denis0"
 
+// Трассировка записей в консоль занимает больше времени, чем сама
+// запись, и генератор нагрузки измерял бы консоль, а не драйвер
+
+#if defined(CONFIG_EXAMPLES_TEST_TASK_MODE_STRESS) && \
+    defined(CONFIG_EXAMPLES_TEST_TASK_DENIS_TRACE)
+#  warning Load generator will not run with CONFIG_EXAMPLES_TEST_TASK_DENIS_TRACE
+#endif
+
+// Как часто task_counter выводит распределение задержек, в записях
+
+#define TASK_COUNTER_LATENCY_PERIOD    10
+
 /****************************************************************************
  * Private Functions
  ****************************************************************************/
 
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+/****************************************************************************
+ * print_latency_dist
+ ****************************************************************************/
+
+/**
+ * @brief Вывести распределение задержки
+ * 
+ * @param name Название задержки
+ * @param dist Распределение
+ * @param count Количество записей в распределении
+ */
+static void print_latency_dist(FAR const char *name,
+                               FAR const struct denis_latency_dist_s *dist,
+                               uint32_t count)
+{
+  int i;
+
+  printf("%s: min %llu ns, avg %llu ns, max %llu ns\n", name,
+         (unsigned long long)dist->min,
+         (unsigned long long)(count ? dist->sum / count : 0),
+         (unsigned long long)dist->max);
+
+  for (i = 0; i < DENIS_LATENCY_BUCKETS; i++)
+    {
+      if (dist->hist[i] != 0)
+        {
+          printf("  %8lu us %s: %lu\n", i == 0 ? 0 : 1ul << i,
+                 i == DENIS_LATENCY_BUCKETS - 1 ? "+   " : "..  ",
+                 (unsigned long)dist->hist[i]);
+        }
+    }
+}
+
+/****************************************************************************
+ * print_latency
+ ****************************************************************************/
+
+/**
+ * @brief Прочитать из драйвера и вывести распределения задержек
+ * 
+ * @param fd Дескриптор открытого устройства DENIS_DEVNAME
+ * @return 0 - в случае успеха, отрицательное значение в ином случае
+ */
+static int print_latency(int fd)
+{
+  struct denis_latency_s latency;
+
+  if (ioctl(fd, DENISIOC_LATENCY_GET, (unsigned long)&latency) < 0)
+    {
+      printf("Failed to read latency: %d\n", errno);
+      return -errno;
+    }
+
+  printf("Latency of %lu timestamped records:\n",
+         (unsigned long)latency.count);
+  print_latency_dist("producer to transfer start", &latency.start,
+                     latency.count);
+  print_latency_dist("producer to transfer end", &latency.end,
+                     latency.count);
+
+  return OK;
+}
+#endif
+
 /****************************************************************************
  * task_counter
  * Task to generate a counter
@@ -72,6 +174,21 @@ static int task_counter(int argc, char *argv[])
       goto exit_without_close;
     }
 
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+  // Включаем режим, в котором драйвер замеряет задержку от создания
+  // записи до начала и окончания ее передачи по шине
+
+  if (ioctl(fd, DENISIOC_TSTAMP, 1) < 0)
+    {
+      printf("%s: Failed to enable timestamps: %d\n", __func__, errno);
+
+      ret = EXIT_FAILURE;
+      goto exit_with_close;
+    }
+
+  uint32_t seq = 0;
+#endif
+
   // Бесконечный цикл, в котором раз в секунду в DENIS_DEVNAME
   // отправляется текущиее время (timestamp) с начала старта программы
 
@@ -79,7 +196,17 @@ static int task_counter(int argc, char *argv[])
   {
     // Читаем текущий таймстамп
 
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+    // Монотонное время в наносекундах в момент создания записи
+
+    struct denis_tstamp_s timestamp;
+
+    timestamp.magic = DENIS_TSTAMP_MAGIC;
+    timestamp.seq = seq++;
+    timestamp.produced = denis_timestamp();
+#else
     time_t timestamp = time(NULL);
+#endif
     size_t timestamp_len = sizeof(timestamp);
 
     // Пишем в открытое устройство DENIS_DEVNAME timestamp-данные
@@ -96,6 +223,13 @@ static int task_counter(int argc, char *argv[])
       ret = EXIT_FAILURE;
       goto exit_with_close;
     }
+
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+    if (seq % TASK_COUNTER_LATENCY_PERIOD == 0)
+    {
+      print_latency(fd);
+    }
+#endif
     
     // Засыпаем на 1 секунду до следующей итерации отправки данных
 
@@ -130,7 +264,9 @@ static int task_counter(int argc, char *argv[])
  * Общий флоу такой:
  * 1. Генерируем две случайные матрицы (случайное количество элементов и случайные значения)
  * 2. Умножаем первую матрицу на вторую
- * 3. Утправляем в устройство DENIS_DEVNAME
+ * 3. Формируем результат прямо в буфере передачи драйвера, отображенном
+ *    через mmap(), и отправляем его в устройство DENIS_DEVNAME одной
+ *    транзакцией без копирования
  * 
  * Для работы с матрицами используется библиотека https://github.com/nomemory/neat-matrix-library
  * 
@@ -160,6 +296,19 @@ static int task_matrix(int argc, char *argv[])
       goto exit_without_close;
     }
 
+  // Отображаем буфер передачи драйвера в память задачи.
+  // Буфер принадлежит открытому файлу и действителен до close(fd)
+
+  FAR double *txbuf = mmap(NULL, DENIS_TXBUF_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+  if (txbuf == MAP_FAILED)
+    {
+      printf("%s: Failed to mmap %s: %d\n", __func__, DENIS_DEVNAME, errno);
+
+      ret = EXIT_FAILURE;
+      goto exit_with_close;
+    }
+
   // Инициализируем генератор случайных чисел rand()
   // Достаточно вызвать только одиин раз
 
@@ -170,7 +319,7 @@ static int task_matrix(int argc, char *argv[])
 
   while (1)
   {
-    nml_mat *m1, *m2, *m3;
+    nml_mat *m1, *m2;
 
     // Генерируем случайные значения размеров двух матриц
     // При этом устанавливаем ограничение размера от 1 до 5 включительно
@@ -200,57 +349,66 @@ static int task_matrix(int argc, char *argv[])
 
     printf("%s: m1 and m2 matrix multiplication:\n", __func__);
 
-    // Умножаем матрицу m1 на матрицу m2
-    // Результат получаем в матрице m3
+    // Умножаем матрицу m1 на матрицу m2 прямо в буфер передачи драйвера.
+    // Результат укладывается построчно, как его ожидает устройство,
+    // поэтому ни промежуточной матрицы, ни копирования не требуется.
+    // Максимальная матрица 5x5 double занимает 200 байт
 
-    m3 = nml_mat_dot(m1, m2);
-    nml_mat_printf(m3, "%.2lf\t\t");
+    struct denis_commit_s commit;
 
-    // При создании матриц используется динамическое выделение памяти
-    // Поэтому освобождаем память, выделенную под матрицы m1 и m2
+    commit.offset = 0;
+    commit.len = nrows_m1 * ncols_m2 * sizeof(*txbuf);
+    if (commit.len > DENIS_TXBUF_SIZE)
+    {
+      printf("%s: ERROR: %lu bytes do not fit the %d byte buffer\n", __func__,
+             (unsigned long)commit.len, DENIS_TXBUF_SIZE);
 
-    nml_mat_free(m1);
-    nml_mat_free(m2);
+      nml_mat_free(m1);
+      nml_mat_free(m2);
 
-    // Отправляем матрицу m3 в устройство DENIS_DEVNAME
+      ret = EXIT_FAILURE;
+      goto exit_with_close;
+    }
 
-    for (int i = 0; i < m3->num_rows; i++)
+    for (unsigned int i = 0; i < nrows_m1; i++)
     {
-      // Созданные при помощи библиотеки nml матрицы не лежат в одной непрерывной области памяти,
-      // поэтому мы не можем просто отправить данные по указателю m3->data
-      // 
-      // Делаем допущение, что нам не требуется отправлять всю матрицу за одну транзакцию
-      // Это позволяет нам не выделять дополнительную память-буфер для формирования неразрывных данных
-      //
-      // Отправляем матрицу построчно
-
-      // Формируем указатель на очередную строку матрицы и фиксируем её длину
-      
-      void *pdata = m3->data[i];
-      size_t data_len = m3->num_cols * sizeof(**m3->data);
-
-      // Пишем в открытое устройство DENIS_DEVNAME строку матрицы
-
-      int nbytes = write(fd, pdata, data_len);
-      if (nbytes != data_len)
+      for (unsigned int j = 0; j < ncols_m2; j++)
       {
-        // Не удалось записать данные в устройство.
-        // Освобождаем память, выделенную для матрицы m3
-
-        nml_mat_free(m3);
-
-        printf("%s: ERROR: write(%zd) returned %d\n", __func__, data_len, nbytes);
+        double sum = 0.0;
 
-        // Завершаем задачу ошибкой, не забыв закрыть устройство
+        for (unsigned int k = 0; k < ncols_m1; k++)
+        {
+          sum += m1->data[i][k] * m2->data[k][j];
+        }
 
-        ret = EXIT_FAILURE;
-        goto exit_with_close;
+        txbuf[i * ncols_m2 + j] = sum;
+        printf("%.2lf\t\t", sum);
       }
+
+      printf("\n");
     }
 
-    // Освобождаем память, выделенную для матрицы m3
+    printf("\n");
+
+    // При создании матриц используется динамическое выделение памяти
+    // Поэтому освобождаем память, выделенную под матрицы m1 и m2
+
+    nml_mat_free(m1);
+    nml_mat_free(m2);
+
+    // Отправляем сформированный кадр в устройство DENIS_DEVNAME одной транзакцией
 
-    nml_mat_free(m3);
+    if (ioctl(fd, DENISIOC_COMMIT, (unsigned long)&commit) < 0)
+    {
+      printf("%s: ERROR: commit(%lu) failed: %d\n", __func__,
+             (unsigned long)commit.len, errno);
+
+      // Не удалось записать данные в устройство.
+      // Завершаем задачу ошибкой, не забыв закрыть устройство
+
+      ret = EXIT_FAILURE;
+      goto exit_with_close;
+    }
 
     // Засыпаем на 3 секунды
     // После пробуждения цикл генерации и отправки матрицы повторяется
@@ -275,6 +433,280 @@ static int task_matrix(int argc, char *argv[])
   exit(ret);
 }
 
+/****************************************************************************
+ * show_usage
+ ****************************************************************************/
+
+/**
+ * @brief Вывести список поддерживаемых команд
+ * 
+ * @param progname Имя программы
+ */
+static void show_usage(FAR const char *progname)
+{
+  printf("Usage:\n");
+  printf("  %s\n", progname);
+  printf("      Initialize %s and start the counter and matrix tasks\n",
+         DENIS_DEVNAME);
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+  printf("  %s latency [reset]\n", progname);
+  printf("      Show or clear the producer-to-wire latency of the counter\n");
+#endif
+#ifdef CONFIG_ARCH_SIM
+  printf("  %s simstat\n", progname);
+  printf("      Show statistics of the simulated denis receiver\n");
+#endif
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_CAPTURE
+  printf("  %s capture start|stop\n", progname);
+  printf("      Start or stop capturing the bus traffic into the RAM ring\n");
+  printf("  %s capture save <file>\n", progname);
+  printf("      Save the RAM ring to <file> and clear it\n");
+  printf("  %s replay <file> [speed%%]\n", progname);
+  printf("      Replay <file> through %s. speed: 100 - original timing "
+         "(default), 0 - no delays\n", DENIS_DEVNAME);
+#endif
+#ifdef CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH
+  printf("  %s bench gemm [count]\n", progname);
+  printf("      Compare per-matrix and batched products of up to 5x5 "
+         "matrices\n");
+  printf("  %s bench accuracy [count]\n", progname);
+  printf("      Check batched products against the double reference\n");
+#endif
+#ifdef CONFIG_EXAMPLES_TEST_TASK_STRESS
+  printf("  %s stress [-n producers] [-s bytes] [-r rate] [-i step] "
+         "[-k steps] [-t ms] [-p priority]\n", progname);
+  printf("      Ramp the offered load on %s from <rate> records/s by <step>\n"
+         "      every <ms> until the driver saturates\n", DENIS_DEVNAME);
+#endif
+}
+
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_CAPTURE
+/****************************************************************************
+ * command_capture
+ ****************************************************************************/
+
+/**
+ * @brief Управление захватом трафика шины в уже инициализированном драйвере
+ * 
+ * @param argc Количество аргументов команды
+ * @param argv Аргументы команды: start, stop или save <file>
+ * @return int Результат выполнения
+ */
+static int command_capture(int argc, FAR char *argv[])
+{
+  int ret;
+  int fd;
+
+  fd = open(DENIS_DEVNAME, O_WRONLY);
+  if (fd < 0)
+    {
+      printf("Failed to open %s: %d\n", DENIS_DEVNAME, errno);
+      return EXIT_FAILURE;
+    }
+
+  if (argc == 1 && strcmp(argv[0], "start") == 0)
+    {
+      ret = ioctl(fd, DENISIOC_CAPTURE_START, 0);
+    }
+  else if (argc == 1 && strcmp(argv[0], "stop") == 0)
+    {
+      ret = ioctl(fd, DENISIOC_CAPTURE_STOP, 0);
+    }
+  else if (argc == 2 && strcmp(argv[0], "save") == 0)
+    {
+      ret = ioctl(fd, DENISIOC_CAPTURE_SAVE, (unsigned long)argv[1]);
+    }
+  else
+    {
+      close(fd);
+      return -EINVAL;
+    }
+
+  if (ret < 0)
+    {
+      printf("Capture %s failed: %d\n", argv[0], errno);
+    }
+
+  close(fd);
+
+  return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
+
+#ifdef CONFIG_EXAMPLES_TEST_TASK_STRESS
+/****************************************************************************
+ * command_stress
+ ****************************************************************************/
+
+/**
+ * @brief Запустить нагрузочный тест с параметрами из командной строки
+ * 
+ * Параметры, не заданные в командной строке, берутся из Kconfig
+ * 
+ * @param argc Количество аргументов командной строки
+ * @param argv Аргументы командной строки, argv[1] == "stress"
+ * @return int Результат выполнения
+ */
+static int command_stress(int argc, FAR char *argv[])
+{
+  struct stress_config_s cfg;
+  int option;
+
+  stress_default_config(&cfg, DENIS_DEVNAME);
+
+  // Разбираем параметры после имени команды: getopt() сам сбрасывает
+  // optind в начале разбора
+
+  while ((option = getopt(argc - 1, &argv[1], "n:s:r:i:k:t:p:")) != ERROR)
+    {
+      switch (option)
+        {
+          case 'n':
+            cfg.nproducers = strtoul(optarg, NULL, 10);
+            break;
+
+          case 's':
+            cfg.payload = strtoul(optarg, NULL, 10);
+            break;
+
+          case 'r':
+            cfg.rate_start = strtoul(optarg, NULL, 10);
+            break;
+
+          case 'i':
+            cfg.rate_step = strtoul(optarg, NULL, 10);
+            break;
+
+          case 'k':
+            cfg.nsteps = strtoul(optarg, NULL, 10);
+            break;
+
+          case 't':
+            cfg.step_ms = strtoul(optarg, NULL, 10);
+            break;
+
+          case 'p':
+            cfg.priority = atoi(optarg);
+            break;
+
+          default:
+            return -EINVAL;
+        }
+    }
+
+  return stress_run(&cfg) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
+
+/****************************************************************************
+ * run_command
+ ****************************************************************************/
+
+/**
+ * @brief Выполнить команду, заданную аргументами командной строки
+ * 
+ * Команды работают с уже инициализированным устройством DENIS_DEVNAME,
+ * то есть после хотя бы одного запуска программы без аргументов
+ * 
+ * @param argc Количество аргументов командной строки
+ * @param argv Аргументы командной строки
+ * @return int Результат выполнения
+ */
+static int run_command(int argc, FAR char *argv[])
+{
+  int ret = -EINVAL;
+
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_TSTAMP
+  if (strcmp(argv[1], "latency") == 0 && argc <= 3)
+    {
+      int fd = open(DENIS_DEVNAME, O_WRONLY);
+      if (fd < 0)
+        {
+          printf("Failed to open %s: %d\n", DENIS_DEVNAME, errno);
+          return EXIT_FAILURE;
+        }
+
+      if (argc == 3 && strcmp(argv[2], "reset") == 0)
+        {
+          ret = ioctl(fd, DENISIOC_LATENCY_RESET, 0);
+        }
+      else if (argc == 2)
+        {
+          ret = print_latency(fd);
+        }
+
+      close(fd);
+
+      if (ret != -EINVAL)
+        {
+          ret = ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+    }
+#endif
+
+#ifdef CONFIG_ARCH_SIM
+  if (strcmp(argv[1], "simstat") == 0)
+    {
+      struct sim_denis_stats_s stats;
+
+      sim_denis_stats(&stats);
+
+      printf("frames %lu, bytes %lu, counters %lu, matrices %lu, "
+             "errors %lu, bus time %llu us\n",
+             (unsigned long)stats.frames, (unsigned long)stats.bytes,
+             (unsigned long)stats.counters, (unsigned long)stats.matrices,
+             (unsigned long)stats.errors,
+             (unsigned long long)stats.busy_ns / 1000);
+
+      ret = EXIT_SUCCESS;
+    }
+#endif
+
+#ifdef CONFIG_EXAMPLES_TEST_TASK_DENIS_CAPTURE
+  if (strcmp(argv[1], "capture") == 0)
+    {
+      ret = command_capture(argc - 2, &argv[2]);
+    }
+  else if (strcmp(argv[1], "replay") == 0 && (argc == 3 || argc == 4))
+    {
+      unsigned int speed = argc == 4 ? strtoul(argv[3], NULL, 10) : 100;
+
+      ret = denis_replay(DENIS_DEVNAME, argv[2], speed);
+      ret = ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+#endif
+#ifdef CONFIG_EXAMPLES_TEST_TASK_MAT_BATCH
+  if (strcmp(argv[1], "bench") == 0 && argc >= 3 &&
+      strcmp(argv[2], "gemm") == 0)
+    {
+      unsigned int count = argc > 3 ? strtoul(argv[3], NULL, 10) : 1000;
+
+      ret = mat_bench_gemm(count) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+  else if (strcmp(argv[1], "bench") == 0 && argc >= 3 &&
+           strcmp(argv[2], "accuracy") == 0)
+    {
+      unsigned int count = argc > 3 ? strtoul(argv[3], NULL, 10) : 1000;
+
+      ret = mat_bench_accuracy(count) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+#endif
+#ifdef CONFIG_EXAMPLES_TEST_TASK_STRESS
+  if (strcmp(argv[1], "stress") == 0)
+    {
+      ret = command_stress(argc, argv);
+    }
+#endif
+
+  if (ret == -EINVAL)
+    {
+      show_usage(argv[0]);
+      ret = EXIT_FAILURE;
+    }
+
+  return ret;
+}
+
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
@@ -287,9 +719,25 @@ int main(int argc, FAR char *argv[])
 {
   int result;
 
+  // Запуск с аргументами - это команда для уже работающего приложения
+
+  if (argc > 1)
+    {
+      return run_command(argc, argv);
+    }
+
   printf("\n");
   printf("Test Task started!\n");
 
+#if defined(CONFIG_EXAMPLES_TEST_TASK_MODE_STRESS) && \
+    defined(CONFIG_EXAMPLES_TEST_TASK_DENIS_TRACE)
+  // Результаты нагрузочного теста с трассировкой бессмысленны
+
+  printf("*** ERROR: load generator refuses to run with "
+         "CONFIG_EXAMPLES_TEST_TASK_DENIS_TRACE enabled ***\n");
+  goto errout;
+#endif
+
   // Инициализируем устройство "denis" и вешаем его на SPI1.
   // 
   // В идеале платозависимая инициализация устройства
@@ -305,6 +753,26 @@ int main(int argc, FAR char *argv[])
       goto errout;
     }
 
+#ifdef CONFIG_EXAMPLES_TEST_TASK_MODE_STRESS
+  // Вместо задач счетчика и матриц нагружаем устройство генератором
+  // с параметрами из Kconfig
+
+    {
+      struct stress_config_s cfg;
+
+      stress_default_config(&cfg, DENIS_DEVNAME);
+
+      result = stress_run(&cfg);
+      if (result < 0)
+        {
+          printf("Stress test failed: %d\n", result);
+          goto errout;
+        }
+
+      return 0;
+    }
+#endif
+
   // Создаем задачу task_counter для генерации и отпрвки счетчика
   
   result = task_create("task_counter", TASK_COUNTER_PRIORITY, TASK_COUNTER_STACKSIZE, task_counter, NULL);